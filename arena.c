@@ -0,0 +1,89 @@
+#include <string.h>
+
+#include "arena.h"
+#include "memory.h"
+#include "profiler.h"
+#include "vm.h"
+
+#define ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define BLOCK_HEADER ALIGN(sizeof(ArenaBlock))
+#define BLOCK_DATA(block) ((char *)(block) + BLOCK_HEADER)
+
+void initArena(Arena *arena, VM *vm)
+{
+    arena->vm = vm;
+    arena->blocks = NULL;
+}
+
+void freeArena(Arena *arena)
+{
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        reallocate(arena->vm, block, BLOCK_HEADER + block->size, 0);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
+
+static ArenaBlock *newBlock(Arena *arena, size_t size)
+{
+    if (size < ARENA_BLOCK_SIZE)
+    {
+        size = ARENA_BLOCK_SIZE;
+    }
+    PROFILE_KIND(arena->vm, "arena");
+    ArenaBlock *block = (ArenaBlock *)reallocate(arena->vm, NULL, 0, BLOCK_HEADER + size);
+    PROFILE_KIND(arena->vm, NULL);
+    block->size = size;
+    block->used = 0;
+    block->last = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return block;
+}
+
+// Makes sure the next allocations of up to size bytes in total come from
+// one block, so they need no further calls to the system allocator.
+void arenaReserve(Arena *arena, size_t size)
+{
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->size - block->used < size)
+    {
+        newBlock(arena, size);
+    }
+}
+
+void *arenaAllocate(Arena *arena, size_t size)
+{
+    size = ALIGN(size);
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->size - block->used < size)
+    {
+        block = newBlock(arena, size);
+    }
+    block->last = block->used;
+    block->used += size;
+    return BLOCK_DATA(block) + block->last;
+}
+
+void *arenaGrow(Arena *arena, void *previous, size_t oldSize, size_t newSize)
+{
+    ArenaBlock *block = arena->blocks;
+    if (previous != NULL && block != NULL &&
+        (char *)previous == BLOCK_DATA(block) + block->last &&
+        block->size - block->last >= ALIGN(newSize))
+    {
+        // The most recent allocation can simply be extended in place.
+        block->used = block->last + ALIGN(newSize);
+        return previous;
+    }
+
+    void *result = arenaAllocate(arena, newSize);
+    if (previous != NULL)
+    {
+        memcpy(result, previous, oldSize < newSize ? oldSize : newSize);
+    }
+    return result;
+}
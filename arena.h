@@ -0,0 +1,31 @@
+#ifndef clox_arena_h
+#define clox_arena_h
+
+#include "common.h"
+
+// A bump allocator for data that lives exactly as long as one compile
+// and run. Nothing is freed individually, freeArena() releases it all.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct sArenaBlock
+{
+    struct sArenaBlock *next;
+    size_t size;
+    size_t used;
+    size_t last;
+} ArenaBlock;
+
+typedef struct
+{
+    VM *vm;
+    ArenaBlock *blocks;
+} Arena;
+
+void initArena(Arena *arena, VM *vm);
+void freeArena(Arena *arena);
+void arenaReserve(Arena *arena, size_t size);
+void *arenaAllocate(Arena *arena, size_t size);
+void *arenaGrow(Arena *arena, void *previous, size_t oldSize, size_t newSize);
+
+#endif
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Usage: bench/compare.sh <before.csv> <after.csv>
+#
+# Prints after/before ratios per workload; below 1.00 is an improvement.
+# Peak RSS is also shown in KB, before and after.
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 <before.csv> <after.csv>" >&2
+    exit 64
+fi
+
+awk -F, '
+FNR == 1 { next }
+NR == FNR { wall[$1] = $2; compile[$1] = $3; verify[$1] = $4; run[$1] = $5; insns[$1] = $6; rss[$1] = $7; next }
+function ratio(after, before) { return before > 0 ? sprintf("%.2f", after / before) : "-" }
+{
+    if (!header) {
+        printf "%-12s %8s %8s %8s %8s %8s %8s %10s %10s\n", "workload", "wall", "compile", "verify", "run", "insns",
+               "rss", "rss_before", "rss_after";
+        header = 1;
+    }
+    if (!($1 in wall)) next;
+    printf "%-12s %8s %8s %8s %8s %8s %8s %10s %10s\n", $1, ratio($2, wall[$1]), ratio($3, compile[$1]),
+           ratio($4, verify[$1]), ratio($5, run[$1]), ratio($6, insns[$1]), ratio($7, rss[$1]), rss[$1], $7;
+}' "$1" "$2"
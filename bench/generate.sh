@@ -0,0 +1,81 @@
+#!/bin/sh
+# Writes the generated benchmark workloads into the given directory.
+# Every workload is straight-line code, so compile cost scales with it,
+# sized to stay below the 65535 constants one chunk can address. Loops
+# are covered by the hand-written workloads next to this script.
+set -e
+OUT=${1:-bench/generated}
+mkdir -p "$OUT"
+
+# Arithmetic over a hundred globals.
+awk 'BEGIN {
+    for (i = 0; i < 100; i++) printf "var g%d = %d;\n", i, i;
+    for (i = 0; i < 10000; i++)
+        printf "g%d = g%d + g%d * 2 - g%d / 4;\n", i % 100, (i + 1) % 100, (i + 7) % 100, (i + 3) % 100;
+    print "print g0;";
+}' > "$OUT/globals.lox"
+
+# The same arithmetic with the working state in block locals.
+awk 'BEGIN {
+    print "{";
+    for (i = 0; i < 100; i++) printf "var l%d = %d;\n", i, i;
+    for (i = 0; i < 10000; i++)
+        printf "l%d = l%d + l%d * 2 - l%d / 4;\n", i % 100, (i + 1) % 100, (i + 7) % 100, (i + 3) % 100;
+    print "print l0;";
+    print "}";
+}' > "$OUT/locals.lox"
+
+# Key-building chains of string concatenation.
+awk 'BEGIN {
+    print "var sep = \":\"; var a = \"alpha\"; var b = \"beta\"; var c = \"gamma\"; var k = nil;";
+    for (i = 0; i < 8000; i++) print "k = a + sep + b + sep + c;";
+    print "print k;";
+}' > "$OUT/concat.lox"
+
+# Distinct literals interned by the compiler and distinct strings
+# interned at runtime.
+awk 'BEGIN {
+    print "var s = nil;";
+    for (i = 0; i < 20000; i++) printf "s = \"key_\" + \"%d\";\n", i;
+    print "print s;";
+}' > "$OUT/interning.lox"
+
+# Expressions nested a hundred levels deep.
+awk 'BEGIN {
+    for (i = 0; i < 600; i++) {
+        line = "print ";
+        for (d = 0; d < 100; d++) line = line sprintf("%d %s (", d + 1, (d % 2) ? "*" : "+");
+        line = line "1";
+        for (d = 0; d < 100; d++) line = line ")";
+        print line ";";
+    }
+}' > "$OUT/deep.lox"
+
+# Printing numbers, whole and fractional.
+awk 'BEGIN {
+    for (i = 0; i < 30000; i++) printf "print %d / %d;\n", i * 37, (i % 3 == 0) ? 1 : 7;
+}' > "$OUT/printing.lox"
+
+# Compile throughput on numeric literals: whole numbers, short decimals
+# and a few long ones that need the slow path.
+awk 'BEGIN {
+    srand(7);
+    for (i = 0; i < 6000; i++) {
+        line = "print " int(rand() * 100000);
+        for (j = 1; j < 10; j++) {
+            if (j % 3 == 0) line = line sprintf(" + %d.%03d", int(rand() * 10000), int(rand() * 1000));
+            else if (j == 8) line = line sprintf(" + 0.%d%d", int(rand() * 1000000000), int(rand() * 1000000000));
+            else line = line sprintf(" + %d", int(rand() * 1000000));
+        }
+        print line ";";
+    }
+}' > "$OUT/literals.lox"
+
+# One chunk with a constant pool of 65000 distinct numbers.
+awk 'BEGIN {
+    for (i = 0; i < 6500; i++) {
+        line = "print " (i * 10) ".5";
+        for (j = 1; j < 10; j++) line = line sprintf(" + %d.25", i * 10 + j);
+        print line ";";
+    }
+}' > "$OUT/constants.lox"
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Usage: bench/run.sh <cLox binary> <results.csv> [repetitions]
+#
+# Runs every workload with --bench and keeps the fastest of the
+# repetitions. Results go to a CSV so two builds can be compared with
+# bench/compare.sh.
+set -e
+BIN=$1
+RESULTS=$2
+REPEAT=${3:-3}
+DIR=$(dirname "$0")
+GENERATED="$DIR/generated"
+
+if [ -z "$BIN" ] || [ -z "$RESULTS" ]; then
+    echo "Usage: $0 <cLox binary> <results.csv> [repetitions]" >&2
+    exit 64
+fi
+
+"$DIR/generate.sh" "$GENERATED"
+
+now_ns() {
+    date +%s%N
+}
+
+echo "workload,wall_ms,compile_ms,verify_ms,run_ms,instructions,peak_rss_kb" > "$RESULTS"
+printf "%-12s %10s %10s %10s %10s %12s %10s\n" workload wall_ms compile_ms verify_ms run_ms instructions rss_kb
+for script in "$DIR"/*.lox "$GENERATED"/*.lox; do
+    [ -f "$script" ] || continue
+    name=$(basename "$script" .lox)
+    best=""
+    for i in $(seq "$REPEAT"); do
+        start=$(now_ns)
+        "$BIN" --bench "$script" > /dev/null 2> "$GENERATED/$name.stats" || true
+        end=$(now_ns)
+        wall=$(( (end - start) / 1000 ))
+        if [ -z "$best" ] || [ "$wall" -lt "$best" ]; then
+            best=$wall
+            stats=$(tail -n 1 "$GENERATED/$name.stats")
+        fi
+    done
+    row=$(echo "$stats" | awk -v name="$name" -v wall="$best" '{
+        for (i = 1; i <= NF; i++) { split($i, kv, "="); v[kv[1]] = kv[2]; }
+        printf "%s,%.3f,%s,%s,%s,%s,%s", name, wall / 1000, v["compile_ms"], v["verify_ms"], v["run_ms"],
+               v["instructions"], v["peak_rss_kb"];
+    }')
+    echo "$row" >> "$RESULTS"
+    echo "$row" | awk -F, '{ printf "%-12s %10s %10s %10s %10s %12s %10s\n", $1, $2, $3, $4, $5, $6, $7 }'
+done
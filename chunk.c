@@ -1,9 +1,16 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "chunk.h"
 #include "memory.h"
 #include "value.h"
 
+#define GROW_CHUNK_ARRAY(vm, chunk, previous, type, oldCount, count)                    \
+    ((chunk)->arena != NULL                                                             \
+         ? (type *)arenaGrow((chunk)->arena, previous, sizeof(type) * (oldCount),       \
+                             sizeof(type) * (count))                                    \
+         : GROW_ARRAY(vm, previous, type, oldCount, count))
+
 void initChunk(Chunk *chunk)
 {
     chunk->count = 0;
@@ -13,27 +20,81 @@ void initChunk(Chunk *chunk)
     chunk->linecapacity = 0;
     chunk->linecounter = NULL;
     chunk->lines = NULL;
+    chunk->arena = NULL;
+    chunk->verified = false;
+    chunk->maxStack = 0;
+    chunk->frozen = false;
+    chunk->block = NULL;
+    chunk->blockSize = 0;
     initValueArray(&chunk->constants);
 }
 
-void freeChunk(Chunk *chunk)
+#ifdef DEBUG
+#define CHECK_WRITABLE(chunk)                                   \
+    do                                                          \
+    {                                                           \
+        if ((chunk)->frozen)                                    \
+        {                                                       \
+            fprintf(stderr, "Write to a frozen chunk.\n");      \
+            abort();                                            \
+        }                                                       \
+    } while (false)
+#else
+#define CHECK_WRITABLE(chunk) ((void)0)
+#endif
+
+// Moves the chunk's buffers into the arena, sized from the length of the
+// source so that compiling it rarely has to grow them.
+void reserveChunk(Chunk *chunk, Arena *arena, int sourceLength)
 {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->linecapacity);
-    FREE_ARRAY(int, chunk->linecounter, chunk->linecapacity);
-    freeValueArray(&chunk->constants);
+    int codeCapacity = sourceLength / 2 + 16;
+    int lineCapacity = sourceLength / 24 + 8;
+    int constantCapacity = sourceLength / 8 + 8;
+
+    arenaReserve(arena, codeCapacity + 2 * lineCapacity * sizeof(int) +
+                            constantCapacity * sizeof(Value) + 4 * ARENA_ALIGNMENT);
+    chunk->code = (uint8_t *)arenaAllocate(arena, codeCapacity);
+    chunk->capacity = codeCapacity;
+    chunk->lines = (int *)arenaAllocate(arena, lineCapacity * sizeof(int));
+    chunk->linecounter = (int *)arenaAllocate(arena, lineCapacity * sizeof(int));
+    chunk->linecapacity = lineCapacity;
+    chunk->constants.values = (Value *)arenaAllocate(arena, constantCapacity * sizeof(Value));
+    chunk->constants.capacity = constantCapacity;
+    chunk->arena = arena;
+}
+
+void freeChunk(VM *vm, Chunk *chunk)
+{
+    if (chunk->arena != NULL)
+    {
+        // The buffers go away together with the arena.
+        initChunk(chunk);
+        return;
+    }
+    if (chunk->frozen)
+    {
+        FREE_ARRAY(vm, uint8_t, chunk->block, chunk->blockSize);
+        initChunk(chunk);
+        return;
+    }
+    FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(vm, int, chunk->lines, chunk->linecapacity);
+    FREE_ARRAY(vm, int, chunk->linecounter, chunk->linecapacity);
+    freeValueArray(vm, &chunk->constants);
 
     initChunk(chunk);
 }
 
-void writeChunk(Chunk *chunk, uint8_t byte, int line)
+void writeChunk(VM *vm, Chunk *chunk, uint8_t byte, int line)
 {
+    CHECK_WRITABLE(chunk);
+    chunk->verified = false;
     if (chunk->capacity < chunk->count + 1)
     {
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
-        chunk->code = GROW_ARRAY(chunk->code, uint8_t,
-                                 oldCapacity, chunk->capacity);
+        chunk->code = GROW_CHUNK_ARRAY(vm, chunk, chunk->code, uint8_t,
+                                       oldCapacity, chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
@@ -49,8 +110,8 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line)
         {
             int oldCapacity = chunk->linecapacity;
             chunk->linecapacity = GROW_CAPACITY(oldCapacity);
-            chunk->linecounter = GROW_ARRAY(chunk->linecounter, int, oldCapacity, chunk->linecapacity);
-            chunk->lines = GROW_ARRAY(chunk->lines, int, oldCapacity, chunk->linecapacity);
+            chunk->linecounter = GROW_CHUNK_ARRAY(vm, chunk, chunk->linecounter, int, oldCapacity, chunk->linecapacity);
+            chunk->lines = GROW_CHUNK_ARRAY(vm, chunk, chunk->lines, int, oldCapacity, chunk->linecapacity);
         }
         chunk->lines[chunk->linecount] = line;
         chunk->linecounter[chunk->linecount] = 1;
@@ -58,12 +119,99 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line)
     }
 }
 
-int addConstant(Chunk *chunk, Value value)
+// Drops the code from count on, so the compiler can rewrite the last
+// instruction it emitted.
+void truncateChunk(Chunk *chunk, int count)
 {
-    writeValueArray(&chunk->constants, value);
+    CHECK_WRITABLE(chunk);
+    chunk->verified = false;
+    while (chunk->count > count)
+    {
+        chunk->count--;
+        if (--chunk->linecounter[chunk->linecount - 1] == 0)
+        {
+            chunk->linecount--;
+        }
+    }
+}
+
+int addConstant(VM *vm, Chunk *chunk, Value value)
+{
+    CHECK_WRITABLE(chunk);
+    ValueArray *constants = &chunk->constants;
+    if (chunk->arena != NULL && constants->capacity < constants->count + 1)
+    {
+        int oldCapacity = constants->capacity;
+        constants->capacity = GROW_CAPACITY(oldCapacity);
+        constants->values = GROW_CHUNK_ARRAY(vm, chunk, constants->values, Value,
+                                             oldCapacity, constants->capacity);
+    }
+    writeValueArray(vm, constants, value);
     return chunk->constants.count - 1;
 }
 
+static size_t alignUp(size_t offset, size_t alignment)
+{
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// Packs the code, the constants and the line table, in that order, into
+// one block without slack so a running chunk touches as few cache lines
+// as possible, and frees the growable arrays. An arena chunk is only
+// marked frozen: reserveChunk() already laid its arrays out next to each
+// other, and the arena cannot free them, so a copy would only add to it.
+void freezeChunk(VM *vm, Chunk *chunk)
+{
+    if (chunk->frozen)
+    {
+        return;
+    }
+    if (chunk->arena != NULL)
+    {
+        chunk->frozen = true;
+        return;
+    }
+    size_t constantsOffset = alignUp((size_t)chunk->count, _Alignof(Value));
+    size_t linesOffset = alignUp(constantsOffset + (size_t)chunk->constants.count * sizeof(Value),
+                                 _Alignof(int));
+    size_t size = linesOffset + 2 * (size_t)chunk->linecount * sizeof(int);
+    size_t blockSize = size + CHUNK_ALIGNMENT;
+    uint8_t *block = ALLOCATE(vm, uint8_t, blockSize);
+    uint8_t *start = (uint8_t *)alignUp((uintptr_t)block, CHUNK_ALIGNMENT);
+
+    uint8_t *code = start;
+    Value *constants = (Value *)(start + constantsOffset);
+    int *linecounter = (int *)(start + linesOffset);
+    int *lines = linecounter + chunk->linecount;
+    memcpy(code, chunk->code, chunk->count);
+    if (chunk->constants.count > 0)
+    {
+        memcpy(constants, chunk->constants.values, chunk->constants.count * sizeof(Value));
+    }
+    if (chunk->linecount > 0)
+    {
+        memcpy(linecounter, chunk->linecounter, chunk->linecount * sizeof(int));
+        memcpy(lines, chunk->lines, chunk->linecount * sizeof(int));
+    }
+
+    int constantCount = chunk->constants.count;
+    FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(vm, int, chunk->lines, chunk->linecapacity);
+    FREE_ARRAY(vm, int, chunk->linecounter, chunk->linecapacity);
+    freeValueArray(vm, &chunk->constants);
+    chunk->code = code;
+    chunk->capacity = chunk->count;
+    chunk->constants.values = constants;
+    chunk->constants.count = constantCount;
+    chunk->constants.capacity = constantCount;
+    chunk->linecounter = linecounter;
+    chunk->lines = lines;
+    chunk->linecapacity = chunk->linecount;
+    chunk->frozen = true;
+    chunk->block = block;
+    chunk->blockSize = blockSize;
+}
+
 /*
 bool writeConstant(Chunk *chunk, Value value, int line)
 {
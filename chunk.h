@@ -1,6 +1,7 @@
 #ifndef clox_chunk_h
 #define clox_chunk_h
 
+#include "arena.h"
 #include "common.h"
 #include "value.h"
 
@@ -28,9 +29,51 @@ typedef enum
     OP_GET_GLOBAL_LONG,
     OP_SET_GLOBAL,
     OP_SET_GLOBAL_LONG,
+    OP_CONCAT_N,
+    // Unchecked forms the compiler emits when both operands are known to
+    // be numbers.
+    OP_ADD_NN,
+    OP_SUBTRACT_NN,
+    OP_MULTIPLY_NN,
+    OP_DIVIDE_NN,
+    OP_LESS_NN,
+    OP_GREATER_NN,
+    // Locals live in stack slots numbered from the bottom of the stack.
+    OP_GET_LOCAL,
+    OP_GET_LOCAL_LONG,
+    OP_SET_LOCAL,
+    OP_SET_LOCAL_LONG,
+    OP_POPN,
+    // Jumps take a two-byte distance from the end of the instruction.
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,
+    OP_POP_JUMP_IF_FALSE,
+    OP_LOOP,
+    // Comparisons fused with the conditional jump that consumes them.
+    OP_JUMP_IF_NOT_LESS,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_LESS,
+    OP_JUMP_IF_GREATER,
+    OP_JUMP_IF_NOT_EQUAL,
+    OP_JUMP_IF_EQUAL,
+    OP_CALL,
+    // A call in tail position, which reuses the caller's frame.
+    OP_TAIL_CALL,
+    // Prefixes OP_CONSTANT or a global instruction whose constant does not
+    // fit the _LONG form; a three-byte operand follows the opcode.
+    OP_WIDE,
     OP_RETURN,
 } OpCode;
 
+// Keep OP_RETURN last; tables indexed by opcode are sized from it.
+#define OPCODE_COUNT (OP_RETURN + 1)
+
+// The largest constant index an OP_WIDE instruction can hold.
+#define WIDE_OPERAND_MAX 0xFFFFFF
+
+// A frozen chunk's block starts on a cache line.
+#define CHUNK_ALIGNMENT 64
+
 typedef struct
 {
     int count;
@@ -41,12 +84,25 @@ typedef struct
     int linecount;
     int linecapacity;
     ValueArray constants;
+    Arena *arena;
+    bool verified;
+    int maxStack;
+    // Set by freezeChunk(); a frozen chunk is never written again. code,
+    // constants and the line table then all point into block, aligned to
+    // CHUNK_ALIGNMENT, except in arena chunks, which keep the layout
+    // reserveChunk() gave them and have no block.
+    bool frozen;
+    uint8_t *block;
+    size_t blockSize;
 } Chunk;
 
 void initChunk(Chunk *chunk);
-void freeChunk(Chunk *chunk);
-void writeChunk(Chunk *chunk, uint8_t byte, int line);
-int addConstant(Chunk *chunk, Value value);
+void reserveChunk(Chunk *chunk, Arena *arena, int sourceLength);
+void freeChunk(VM *vm, Chunk *chunk);
+void writeChunk(VM *vm, Chunk *chunk, uint8_t byte, int line);
+void truncateChunk(Chunk *chunk, int count);
+int addConstant(VM *vm, Chunk *chunk, Value value);
+void freezeChunk(VM *vm, Chunk *chunk);
 //bool writeConstant(Chunk *chunk, Value value, int line);
 //bool writeGlobal(Chunk *chunk, Value value, int line);
 
@@ -5,5 +5,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+typedef struct sVM VM;
+
 
 #endif
\ No newline at end of file
@@ -1,20 +1,87 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "compiler.h"
+#include "memory.h"
+#include "profiler.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
+// What the compiler can prove about the value an expression leaves on
+// the stack. Operations that fail at runtime on the wrong types still
+// prove their result type, since they only produce one on success.
+typedef enum
+{
+    TYPE_UNKNOWN,
+    TYPE_NUMBER, // An integer or a double.
+    TYPE_STRING,
+    TYPE_BOOL,
+    TYPE_NIL,
+} ExprType;
+
+// The name is interned because a streaming scanner may have dropped the
+// source text by the time the local goes out of scope. Its hash lets most
+// lookups skip the memcmp().
+typedef struct
+{
+    ObjString *name;
+    int depth; // -1 until its initializer has been compiled.
+} Local;
+
+typedef enum
+{
+    TYPE_FUNCTION,
+    TYPE_SCRIPT,
+} FunctionType;
+
+// One per function being compiled, innermost first. Locals are resolved
+// in the innermost compiler only.
+typedef struct sCompiler
+{
+    struct sCompiler *enclosing;
+    ObjFunction *function; // NULL for the script.
+    FunctionType type;
+    Chunk *chunk;
+
+    // Locals in scope, in stack slot order. The array lives on the VM
+    // heap only while compiling.
+    Local *locals;
+    int localCount;
+    int localCapacity;
+    int scopeDepth;
+} Compiler;
+
 typedef struct
 {
+    Scanner scanner;
     Token current;
     Token previous;
     bool hadError;
     bool panicMode;
+    VM *vm;
+    Compiler *compiler;
+
+    // The OP_ADD or OP_CONCAT_N ending the last chain of +, its offset,
+    // the offset after it and how many operands it joins.
+    int chainStart;
+    int chainEnd;
+    int chainLength;
+
+    // The type of the expression compiled last.
+    ExprType lastType;
+
+    // The comparison emitted last and the offset after it. A conditional
+    // jump right after it fuses with it.
+    int compareStart;
+    int compareEnd;
+
+    // The offset after the OP_CALL emitted last.
+    int callEnd;
 } Parser;
 
 typedef enum
@@ -32,7 +99,7 @@ typedef enum
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)(bool canAssign);
+typedef void (*ParseFn)(Parser *parser, bool canAssign);
 
 typedef struct
 {
@@ -41,31 +108,28 @@ typedef struct
     Precedence precedence;
 } ParseRule;
 
-Parser parser;
-
-Chunk *compilingChunk;
+static void expression(Parser *parser);
+static void statement(Parser *parser);
+static void declaration(Parser *parser);
+static void emitConstant(Parser *parser, Value value);
 
-static void expression();
-static void statement();
-static void declaration();
-
-static Chunk *currentChunk()
+static Chunk *currentChunk(Parser *parser)
 {
-    return compilingChunk;
+    return parser->compiler->chunk;
 }
 
-static void errorAt(Token *token, const char *message)
+static void errorAt(Parser *parser, Token *token, const char *message)
 {
-    if (parser.panicMode)
+    if (parser->panicMode)
     {
         return;
     }
-    parser.panicMode = true;
-    fprintf(stderr, "[line %d] Error", token->line);
+    parser->panicMode = true;
+    fprintf(parser->vm->errors, "[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF)
     {
-        fprintf(stderr, " at end");
+        fprintf(parser->vm->errors, " at end");
     }
     else if (token->type == TOKEN_ERROR)
     {
@@ -73,266 +137,876 @@ static void errorAt(Token *token, const char *message)
     }
     else
     {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(parser->vm->errors, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", message);
-    parser.hadError = true;
+    fprintf(parser->vm->errors, ": %s\n", message);
+    parser->hadError = true;
 }
 
-static void error(const char *message)
+static void error(Parser *parser, const char *message)
 {
-    errorAt(&parser.previous, message);
+    errorAt(parser, &parser->previous, message);
 }
 
-static void errorAtCurrent(const char *message)
+static void errorAtCurrent(Parser *parser, const char *message)
 {
-    errorAt(&parser.current, message);
+    errorAt(parser, &parser->current, message);
 }
 
-static void advance()
+static void advance(Parser *parser)
 {
-    parser.previous = parser.current;
+    parser->previous = parser->current;
+    PROFILE_COMPILE_LINE(parser->vm, parser->previous.line);
 
     for (;;)
     {
-        parser.current = scanToken();
-        if (parser.current.type != TOKEN_ERROR)
+        parser->current = scanToken(&parser->scanner);
+        parser->vm->stats.tokens++;
+        if (parser->current.type != TOKEN_ERROR)
             break;
 
-        errorAtCurrent(parser.current.start);
+        errorAtCurrent(parser, parser->current.start);
     }
 }
 
-static void consume(TokenType type, const char *message)
+static void consume(Parser *parser, TokenType type, const char *message)
 {
-    if (parser.current.type == type)
+    if (parser->current.type == type)
     {
-        advance();
+        advance(parser);
         return;
     }
 
-    errorAtCurrent(message);
+    errorAtCurrent(parser, message);
 }
 
-static bool check(TokenType type)
+static bool check(Parser *parser, TokenType type)
 {
-    return parser.current.type == type;
+    return parser->current.type == type;
 }
 
-static bool match(TokenType type)
+static bool match(Parser *parser, TokenType type)
 {
-    if (!check(type))
+    if (!check(parser, type))
     {
         return false;
     }
-    advance();
+    advance(parser);
     return true;
 }
 
-static void emitByte(uint8_t byte)
+static void emitByte(Parser *parser, uint8_t byte)
 {
-    writeChunk(currentChunk(), byte, parser.previous.line);
+    writeChunk(parser->vm, currentChunk(parser), byte, parser->previous.line);
 }
 
-static void emitBytes(uint8_t byte1, uint8_t byte2)
+static void emitBytes(Parser *parser, uint8_t byte1, uint8_t byte2)
 {
-    emitByte(byte1);
-    emitByte(byte2);
+    emitByte(parser, byte1);
+    emitByte(parser, byte2);
 }
 
-static void emitReturn()
+// Emits a forward jump and returns the offset of its operand for
+// patchJump().
+static int emitJump(Parser *parser, uint8_t instruction)
 {
-    emitByte(OP_RETURN);
+    emitByte(parser, instruction);
+    emitBytes(parser, 0xff, 0xff);
+    return currentChunk(parser)->count - 2;
 }
 
-static int makeConstant(Value value)
+// Code ending at the current offset becomes a jump target, so neither
+// the last chain of + nor the last comparison may be rewritten.
+static void markTarget(Parser *parser)
 {
-    return addConstant(currentChunk(), value);
+    parser->chainEnd = -1;
+    parser->compareEnd = -1;
+    parser->callEnd = -1;
 }
 
-static void endCompiler()
+static void patchJump(Parser *parser, int offset)
 {
-    emitReturn();
+    Chunk *chunk = currentChunk(parser);
+    // -2 to adjust for the jump operand itself.
+    int jump = chunk->count - offset - 2;
+    if (jump > UINT16_MAX)
+    {
+        error(parser, "Too much code to jump over.");
+    }
+    chunk->code[offset] = jump & 0xff;
+    chunk->code[offset + 1] = (jump >> 8) & 0xff;
+    markTarget(parser);
+}
+
+static void emitLoop(Parser *parser, int loopStart)
+{
+    emitByte(parser, OP_LOOP);
+    int offset = currentChunk(parser)->count - loopStart + 2;
+    if (offset > UINT16_MAX)
+    {
+        error(parser, "Loop body too large.");
+    }
+    emitBytes(parser, offset & 0xff, (offset >> 8) & 0xff);
+}
+
+// Jumps when the condition just compiled is falsey, popping it either
+// way. A comparison ending the condition is replaced by a fused
+// compare-and-jump.
+static int emitConditionJump(Parser *parser)
+{
+    Chunk *chunk = currentChunk(parser);
+    int start = parser->compareStart;
+    if (parser->compareEnd != chunk->count)
+    {
+        return emitJump(parser, OP_POP_JUMP_IF_FALSE);
+    }
+
+    bool negated = chunk->count - start == 2;
+    uint8_t instruction;
+    switch (chunk->code[start])
+    {
+    case OP_LESS:
+    case OP_LESS_NN:
+        instruction = negated ? OP_JUMP_IF_LESS : OP_JUMP_IF_NOT_LESS;
+        break;
+    case OP_GREATER:
+    case OP_GREATER_NN:
+        instruction = negated ? OP_JUMP_IF_GREATER : OP_JUMP_IF_NOT_GREATER;
+        break;
+    default:
+        instruction = negated ? OP_JUMP_IF_EQUAL : OP_JUMP_IF_NOT_EQUAL;
+        break;
+    }
+    truncateChunk(chunk, start);
+    parser->compareEnd = -1;
+    return emitJump(parser, instruction);
+}
+
+static void emitReturn(Parser *parser)
+{
+    emitBytes(parser, OP_NIL, OP_RETURN);
+}
+
+static int makeConstant(Parser *parser, Value value)
+{
+    return addConstant(parser->vm, currentChunk(parser), value);
+}
+
+// Emits an instruction taking a constant index in the smallest form it
+// fits: one byte, two bytes after longInstruction, or three after the
+// OP_WIDE prefix.
+static void emitIndexed(Parser *parser, uint8_t instruction, uint8_t longInstruction, int index)
+{
+    if (index <= UINT8_MAX)
+    {
+        emitBytes(parser, instruction, (uint8_t)index);
+    }
+    else if (index <= UINT16_MAX)
+    {
+        emitByte(parser, longInstruction);
+        emitBytes(parser, index & 0xFF, index >> 8);
+    }
+    else if (index <= WIDE_OPERAND_MAX)
+    {
+        emitBytes(parser, OP_WIDE, instruction);
+        emitByte(parser, index & 0xFF);
+        emitBytes(parser, (index >> 8) & 0xFF, index >> 16);
+    }
+    else
+    {
+        error(parser, "Too many constants in one chunk.");
+    }
+}
+
+static ObjFunction *endCompiler(Parser *parser)
+{
+    emitReturn(parser);
+    Compiler *compiler = parser->compiler;
 #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError)
+    if (!parser->hadError)
     {
-        disassembleChunk(currentChunk(), "code");
+        disassembleChunk(currentChunk(parser),
+                         compiler->function != NULL ? compiler->function->name->chars : "code");
     }
 #endif
+    if (!parser->hadError)
+    {
+        freezeChunk(parser->vm, currentChunk(parser));
+    }
+    FREE_ARRAY(parser->vm, Local, compiler->locals, compiler->localCapacity);
+    parser->compiler = compiler->enclosing;
+    // Offsets remembered for the enclosing chunk are stale now.
+    markTarget(parser);
+    return compiler->function;
 }
 
 static ParseRule *getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Parser *parser, Precedence precedence);
+
+// When the left operand of + is the chain of + emitted last, its
+// add or OP_CONCAT_N is dropped so that the chain takes one more
+// operand. Returns how many operands are already on the stack.
+static int continueAddChain(Parser *parser)
+{
+    Chunk *chunk = currentChunk(parser);
+    if (chunk->count != parser->chainEnd || parser->chainLength == UINT8_MAX)
+    {
+        return 1;
+    }
+    truncateChunk(chunk, parser->chainStart);
+    parser->chainEnd = -1;
+    return parser->chainLength;
+}
+
+static void emitAddChain(Parser *parser, int operands, bool numbers)
+{
+    parser->chainStart = currentChunk(parser)->count;
+    if (operands == 2)
+    {
+        emitByte(parser, numbers ? OP_ADD_NN : OP_ADD);
+    }
+    else
+    {
+        emitBytes(parser, OP_CONCAT_N, (uint8_t)operands);
+    }
+    parser->chainEnd = currentChunk(parser)->count;
+    parser->chainLength = operands;
+}
 
-static void binary(bool canAssign)
+static void binary(Parser *parser, bool canAssign)
 {
     // Remember the operator.
-    TokenType operatorType = parser.previous.type;
+    TokenType operatorType = parser->previous.type;
+    ExprType left = parser->lastType;
+    int operands = operatorType == TOKEN_PLUS ? continueAddChain(parser) : 1;
 
     // Compile the right operand.
     ParseRule *rule = getRule(operatorType);
-    parsePrecedence((Precedence)(rule->precedence + 1));
-
-    // Emit the operator instruction.
+    parsePrecedence(parser, (Precedence)(rule->precedence + 1));
+    ExprType right = parser->lastType;
+
+    // Emit the operator instruction, unchecked when both operands are
+    // known to be numbers.
+    bool numbers = left == TYPE_NUMBER && right == TYPE_NUMBER;
+    int start = currentChunk(parser)->count;
+    parser->lastType = TYPE_BOOL;
     switch (operatorType)
     {
     case TOKEN_BANG_EQUAL:
-        emitBytes(OP_EQUAL, OP_NOT);
+        emitBytes(parser, OP_EQUAL, OP_NOT);
         break;
     case TOKEN_EQUAL_EQUAL:
-        emitByte(OP_EQUAL);
+        emitByte(parser, OP_EQUAL);
         break;
     case TOKEN_GREATER:
-        emitByte(OP_GREATER);
+        emitByte(parser, numbers ? OP_GREATER_NN : OP_GREATER);
         break;
     case TOKEN_GREATER_EQUAL:
-        emitBytes(OP_LESS, OP_NOT);
+        emitBytes(parser, numbers ? OP_LESS_NN : OP_LESS, OP_NOT);
         break;
     case TOKEN_LESS:
-        emitByte(OP_LESS);
+        emitByte(parser, numbers ? OP_LESS_NN : OP_LESS);
         break;
     case TOKEN_LESS_EQUAL:
-        emitBytes(OP_GREATER, OP_NOT);
+        emitBytes(parser, numbers ? OP_GREATER_NN : OP_GREATER, OP_NOT);
         break;
     case TOKEN_PLUS:
-        emitByte(OP_ADD);
+        emitAddChain(parser, operands + 1, numbers);
+        // A checked add with one known side succeeds only on that type.
+        parser->lastType = left == TYPE_NUMBER || right == TYPE_NUMBER   ? TYPE_NUMBER
+                           : left == TYPE_STRING || right == TYPE_STRING ? TYPE_STRING
+                                                                         : TYPE_UNKNOWN;
         break;
     case TOKEN_MINUS:
-        emitByte(OP_SUBTRACT);
+        emitByte(parser, numbers ? OP_SUBTRACT_NN : OP_SUBTRACT);
+        parser->lastType = TYPE_NUMBER;
         break;
     case TOKEN_STAR:
-        emitByte(OP_MULTIPLY);
+        emitByte(parser, numbers ? OP_MULTIPLY_NN : OP_MULTIPLY);
+        parser->lastType = TYPE_NUMBER;
         break;
     case TOKEN_SLASH:
-        emitByte(OP_DIVIDE);
+        emitByte(parser, numbers ? OP_DIVIDE_NN : OP_DIVIDE);
+        parser->lastType = TYPE_NUMBER;
         break;
     default:
         return; // Unreachable.
     }
+
+    // Only the comparisons and equality operators produce a bool.
+    if (parser->lastType == TYPE_BOOL)
+    {
+        parser->compareStart = start;
+        parser->compareEnd = currentChunk(parser)->count;
+    }
 }
 
-static void literal(bool canAssign)
+static uint8_t argumentList(Parser *parser)
 {
-    switch (parser.previous.type)
+    uint8_t argCount = 0;
+    if (!check(parser, TOKEN_RIGHT_PAREN))
+    {
+        do
+        {
+            expression(parser);
+            if (argCount == UINT8_MAX)
+            {
+                error(parser, "Can't have more than 255 arguments.");
+            }
+            argCount++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return argCount;
+}
+
+static void call(Parser *parser, bool canAssign)
+{
+    uint8_t argCount = argumentList(parser);
+    emitBytes(parser, OP_CALL, argCount);
+    parser->callEnd = currentChunk(parser)->count;
+    parser->lastType = TYPE_UNKNOWN;
+}
+
+static void and_(Parser *parser, bool canAssign)
+{
+    ExprType left = parser->lastType;
+    int endJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitByte(parser, OP_POP);
+    parsePrecedence(parser, PREC_AND);
+    patchJump(parser, endJump);
+    parser->lastType = left == parser->lastType ? left : TYPE_UNKNOWN;
+}
+
+static void or_(Parser *parser, bool canAssign)
+{
+    ExprType left = parser->lastType;
+    int elseJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    int endJump = emitJump(parser, OP_JUMP);
+    patchJump(parser, elseJump);
+    emitByte(parser, OP_POP);
+    parsePrecedence(parser, PREC_OR);
+    patchJump(parser, endJump);
+    parser->lastType = left == parser->lastType ? left : TYPE_UNKNOWN;
+}
+
+static void literal(Parser *parser, bool canAssign)
+{
+    switch (parser->previous.type)
     {
     case TOKEN_FALSE:
-        emitByte(OP_FALSE);
+        emitByte(parser, OP_FALSE);
+        parser->lastType = TYPE_BOOL;
         break;
     case TOKEN_NIL:
-        emitByte(OP_NIL);
+        emitByte(parser, OP_NIL);
+        parser->lastType = TYPE_NIL;
         break;
     case TOKEN_TRUE:
-        emitByte(OP_TRUE);
+        emitByte(parser, OP_TRUE);
+        parser->lastType = TYPE_BOOL;
         break;
     default:
         return; // Unreachable.
     }
 }
 
-static void parsePrecedence(Precedence precedence)
+static void parsePrecedence(Parser *parser, Precedence precedence)
 {
-    advance();
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+    advance(parser);
+    ParseFn prefixRule = getRule(parser->previous.type)->prefix;
     if (prefixRule == NULL)
     {
-        error("Expect expression.");
+        error(parser, "Expect expression.");
         return;
     }
     bool canAssign = precedence <= PREC_ASSIGNMENT;
-    prefixRule(canAssign);
+    parser->lastType = TYPE_UNKNOWN;
+    prefixRule(parser, canAssign);
 
-    while (precedence <= getRule(parser.current.type)->precedence)
+    while (precedence <= getRule(parser->current.type)->precedence)
     {
-        advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule(canAssign);
+        advance(parser);
+        ParseFn infixRule = getRule(parser->previous.type)->infix;
+        infixRule(parser, canAssign);
     }
-    if(canAssign && match(TOKEN_EQUAL))
+    if(canAssign && match(parser, TOKEN_EQUAL))
     {
-        error("Invalid assignment target.");
-        expression();
+        error(parser, "Invalid assignment target.");
+        expression(parser);
     }
 }
 
-static void defineVariable(int global)
+static void emitPops(Parser *parser, int count)
 {
-    if (global <= UINT8_MAX)
+    while (count > 1)
     {
-        emitByte(OP_DEFINE_GLOBAL);
-        emitByte((uint8_t)global);
+        int batch = count < UINT8_MAX ? count : UINT8_MAX;
+        emitBytes(parser, OP_POPN, (uint8_t)batch);
+        count -= batch;
     }
-    else if (global <= UINT16_MAX)
+    if (count == 1)
     {
-        emitByte(OP_DEFINE_GLOBAL_LONG);
-        uint8_t a = (global - 1) & 0xFF;
-        uint8_t b = (global - 1) >> 8;
-        emitBytes(a, b);
+        emitByte(parser, OP_POP);
+    }
+}
+
+static void beginScope(Parser *parser)
+{
+    parser->compiler->scopeDepth++;
+}
+
+static void endScope(Parser *parser)
+{
+    parser->compiler->scopeDepth--;
+    int count = 0;
+    while (parser->compiler->localCount > 0 &&
+           parser->compiler->locals[parser->compiler->localCount - 1].depth > parser->compiler->scopeDepth)
+    {
+        parser->compiler->localCount--;
+        count++;
+    }
+    emitPops(parser, count);
+}
+
+static bool isLocal(Local *local, Token *name, uint32_t hash)
+{
+    return local->name->hash == hash && local->name->length == name->length &&
+           memcmp(local->name->chars, name->start, name->length) == 0;
+}
+
+// Returns the stack slot of the innermost local with that name, or -1
+// when the name refers to a global.
+static int resolveLocal(Parser *parser, Token *name)
+{
+    Compiler *compiler = parser->compiler;
+    if (compiler->localCount == 0 && compiler->enclosing == NULL)
+    {
+        return -1;
+    }
+    uint32_t hash = hashString(name->start, name->length);
+    for (int i = compiler->localCount - 1; i >= 0; i--)
+    {
+        Local *local = &compiler->locals[i];
+        if (isLocal(local, name, hash))
+        {
+            if (local->depth == -1)
+            {
+                error(parser, "Can't read local variable in its own initializer.");
+            }
+            return i;
+        }
+    }
+
+    // There are no upvalues, so the locals of enclosing functions are out
+    // of reach. A local function naming itself is the exception: it is
+    // the enclosing compiler's newest local, and the callee in slot 0.
+    for (Compiler *enclosing = compiler->enclosing; enclosing != NULL;
+         enclosing = enclosing->enclosing)
+    {
+        for (int i = enclosing->localCount - 1; i >= 0; i--)
+        {
+            Local *local = &enclosing->locals[i];
+            if (!isLocal(local, name, hash))
+            {
+                continue;
+            }
+            if (enclosing == compiler->enclosing && i == enclosing->localCount - 1 &&
+                compiler->function != NULL && local->name == compiler->function->name)
+            {
+                return 0;
+            }
+            error(parser, "Can't use a local variable of an enclosing function.");
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static void addLocal(Parser *parser, Token name)
+{
+    if (parser->compiler->localCount == STACK_MAX)
+    {
+        error(parser, "Too many local variables.");
+        return;
+    }
+    if (parser->compiler->localCount == parser->compiler->localCapacity)
+    {
+        int oldCapacity = parser->compiler->localCapacity;
+        parser->compiler->localCapacity = GROW_CAPACITY(oldCapacity);
+        parser->compiler->locals = GROW_ARRAY(parser->vm, parser->compiler->locals, Local, oldCapacity,
+                                    parser->compiler->localCapacity);
+    }
+    Local *local = &parser->compiler->locals[parser->compiler->localCount++];
+    local->name = copyString(parser->vm, name.start, name.length);
+    local->depth = -1;
+}
+
+static void declareVariable(Parser *parser)
+{
+    if (parser->compiler->scopeDepth == 0)
+    {
+        return;
+    }
+    Token *name = &parser->previous;
+    uint32_t hash = hashString(name->start, name->length);
+    for (int i = parser->compiler->localCount - 1; i >= 0; i--)
+    {
+        Local *local = &parser->compiler->locals[i];
+        if (local->depth != -1 && local->depth < parser->compiler->scopeDepth)
+        {
+            break;
+        }
+        if (isLocal(local, name, hash))
+        {
+            error(parser, "Already a variable with this name in this scope.");
+        }
+    }
+    addLocal(parser, *name);
+}
+
+static void defineVariable(Parser *parser, int global)
+{
+    if (parser->compiler->scopeDepth > 0)
+    {
+        // The initializer's value already sits in the local's slot.
+        parser->compiler->locals[parser->compiler->localCount - 1].depth = parser->compiler->scopeDepth;
+        return;
+    }
+    emitIndexed(parser, OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global);
+}
+
+static int identifierConstant(Parser *parser, Token *name)
+{
+    return makeConstant(parser, OBJ_VAL(copyString(parser->vm, name->start, name->length)));
+}
+
+static int parseVariable(Parser *parser, const char *errorMessage)
+{
+    consume(parser, TOKEN_IDENTIFIER, errorMessage);
+    declareVariable(parser);
+    if (parser->compiler->scopeDepth > 0)
+    {
+        return 0;
+    }
+    return identifierConstant(parser, &parser->previous);
+}
+
+static void expression(Parser *parser)
+{
+    parsePrecedence(parser, PREC_ASSIGNMENT);
+}
+
+static void initCompiler(Parser *parser, Compiler *compiler, FunctionType type, Chunk *chunk)
+{
+    compiler->enclosing = parser->compiler;
+    compiler->function = NULL;
+    compiler->type = type;
+    compiler->chunk = chunk;
+    compiler->locals = NULL;
+    compiler->localCount = 0;
+    compiler->localCapacity = 0;
+    compiler->scopeDepth = 0;
+    parser->compiler = compiler;
+    markTarget(parser);
+    if (type == TYPE_SCRIPT)
+    {
+        return;
+    }
+
+    compiler->function = newFunction(parser->vm);
+    compiler->chunk = &compiler->function->chunk;
+    compiler->function->name = copyString(parser->vm, parser->previous.start,
+                                          parser->previous.length);
+    // Slot 0 holds the function being called and has no name.
+    Token callee = {TOKEN_IDENTIFIER, "", 0, parser->previous.line};
+    addLocal(parser, callee);
+    compiler->locals[0].depth = 0;
+}
+
+static void varDeclaration(Parser *parser)
+{
+    int global = parseVariable(parser, "Expect variable name.");
+    if (match(parser, TOKEN_EQUAL))
+    {
+        expression(parser);
     }
     else
     {
-        error("Too many globals in one chunk.");
+        emitByte(parser, OP_NIL);
     }
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+
+    defineVariable(parser, global);
 }
 
-static int identifierConstant(Token *name)
+static void block(Parser *parser)
 {
-    return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF))
+    {
+        declaration(parser);
+    }
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+}
+
+static void function(Parser *parser, FunctionType type)
+{
+    Compiler compiler;
+    initCompiler(parser, &compiler, type, NULL);
+    beginScope(parser);
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(parser, TOKEN_RIGHT_PAREN))
+    {
+        do
+        {
+            compiler.function->arity++;
+            if (compiler.function->arity > UINT8_MAX)
+            {
+                errorAtCurrent(parser, "Can't have more than 255 parameters.");
+            }
+            int constant = parseVariable(parser, "Expect parameter name.");
+            defineVariable(parser, constant);
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block(parser);
+
+    // The frame is dropped on return, so the body's locals need no pops.
+    ObjFunction *function = endCompiler(parser);
+    emitConstant(parser, OBJ_VAL(function));
 }
 
-static int parseVariable(const char *errorMessage)
+static void funDeclaration(Parser *parser)
 {
-    consume(TOKEN_IDENTIFIER, errorMessage);
-    return identifierConstant(&parser.previous);
+    int global = parseVariable(parser, "Expect function name.");
+    // Usable before its body compiles, so that the body can call the
+    // function. resolveLocal() maps such a call to the callee slot.
+    if (parser->compiler->scopeDepth > 0)
+    {
+        parser->compiler->locals[parser->compiler->localCount - 1].depth =
+            parser->compiler->scopeDepth;
+    }
+    function(parser, TYPE_FUNCTION);
+    defineVariable(parser, global);
 }
 
-static void expression()
+static void expressionStatement(Parser *parser)
 {
-    parsePrecedence(PREC_ASSIGNMENT);
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+    emitByte(parser, OP_POP);
 }
 
-static void varDeclaration()
+// Source text copied out of the scanner's window.
+typedef struct
+{
+    char *chars;
+    int length;
+    int capacity;
+    int line; // Of the first token.
+} SourceCopy;
+
+static void appendSource(Parser *parser, SourceCopy *copy, const char *chars, int length)
 {
-    int global = parseVariable("Expect variable name.");
-    if (match(TOKEN_EQUAL))
+    if (copy->length + length > copy->capacity)
     {
-        expression();
+        int oldCapacity = copy->capacity;
+        while (copy->length + length > copy->capacity)
+        {
+            copy->capacity = GROW_CAPACITY(copy->capacity);
+        }
+        copy->chars = GROW_ARRAY(parser->vm, copy->chars, char, oldCapacity, copy->capacity);
+    }
+    memcpy(copy->chars + copy->length, chars, length);
+    copy->length += length;
+}
+
+// Skips the tokens up to the ')' that closes the for clauses and copies
+// them out, separated by spaces and by newlines where the line changes,
+// so that scanning the copy gives the same tokens on the same lines.
+static void captureIncrement(Parser *parser, SourceCopy *copy)
+{
+    copy->chars = NULL;
+    copy->length = 0;
+    copy->capacity = 0;
+    copy->line = parser->current.line;
+    int line = copy->line;
+    int parens = 0;
+    while (!check(parser, TOKEN_EOF) && (parens > 0 || !check(parser, TOKEN_RIGHT_PAREN)))
+    {
+        if (check(parser, TOKEN_LEFT_PAREN))
+        {
+            parens++;
+        }
+        else if (check(parser, TOKEN_RIGHT_PAREN))
+        {
+            parens--;
+        }
+
+        // A string token carries the line it ends on.
+        Token *token = &parser->current;
+        int newlines = 0;
+        if (token->type == TOKEN_STRING)
+        {
+            for (int i = 0; i < token->length; i++)
+            {
+                newlines += token->start[i] == '\n';
+            }
+        }
+        for (; line < token->line - newlines; line++)
+        {
+            appendSource(parser, copy, "\n", 1);
+        }
+        appendSource(parser, copy, token->start, token->length);
+        appendSource(parser, copy, " ", 1);
+        line += newlines;
+        advance(parser);
+    }
+}
+
+static void forStatement(Parser *parser)
+{
+    beginScope(parser);
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    if (match(parser, TOKEN_SEMICOLON))
+    {
+        // No initializer.
+    }
+    else if (match(parser, TOKEN_VAR))
+    {
+        varDeclaration(parser);
     }
     else
     {
-        emitByte(OP_NIL);
+        expressionStatement(parser);
     }
-    consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
 
-    defineVariable(global);
+    int loopStart = currentChunk(parser)->count;
+    markTarget(parser);
+    int exitJump = -1;
+    if (!match(parser, TOKEN_SEMICOLON))
+    {
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+        exitJump = emitConditionJump(parser);
+    }
+
+    // The increment is compiled after the body, so each iteration falls
+    // through into it instead of jumping there and back. For now it is
+    // copied out as text, since a streaming scanner drops source it has
+    // passed.
+    SourceCopy increment;
+    captureIncrement(parser, &increment);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    statement(parser);
+    if (increment.length > 0)
+    {
+        Scanner bodyScanner = parser->scanner;
+        Token bodyCurrent = parser->current;
+        Token bodyPrevious = parser->previous;
+        initScanner(&parser->scanner, increment.chars, increment.length);
+        parser->scanner.line = increment.line;
+        advance(parser);
+        expression(parser);
+        if (!check(parser, TOKEN_EOF))
+        {
+            errorAtCurrent(parser, "Expect ')' after for clauses.");
+        }
+        emitByte(parser, OP_POP);
+        parser->scanner = bodyScanner;
+        parser->current = bodyCurrent;
+        parser->previous = bodyPrevious;
+    }
+    FREE_ARRAY(parser->vm, char, increment.chars, increment.capacity);
+    emitLoop(parser, loopStart);
+    if (exitJump != -1)
+    {
+        patchJump(parser, exitJump);
+    }
+    endScope(parser);
 }
 
-static void expressionStatement()
+static void ifStatement(Parser *parser)
 {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-    emitByte(OP_POP);
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+    int thenJump = emitConditionJump(parser);
+    statement(parser);
+    if (match(parser, TOKEN_ELSE))
+    {
+        int elseJump = emitJump(parser, OP_JUMP);
+        patchJump(parser, thenJump);
+        statement(parser);
+        patchJump(parser, elseJump);
+    }
+    else
+    {
+        patchJump(parser, thenJump);
+    }
+}
+
+static void whileStatement(Parser *parser)
+{
+    int loopStart = currentChunk(parser)->count;
+    markTarget(parser);
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+    int exitJump = emitConditionJump(parser);
+    statement(parser);
+    emitLoop(parser, loopStart);
+    patchJump(parser, exitJump);
+}
+
+static void returnStatement(Parser *parser)
+{
+    if (parser->compiler->type == TYPE_SCRIPT)
+    {
+        error(parser, "Can't return from top-level code.");
+    }
+
+    if (match(parser, TOKEN_SEMICOLON))
+    {
+        emitReturn(parser);
+        return;
+    }
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+    // A call whose result is returned right away reuses the frame.
+    Chunk *chunk = currentChunk(parser);
+    if (parser->callEnd == chunk->count)
+    {
+        chunk->code[chunk->count - 2] = OP_TAIL_CALL;
+    }
+    emitByte(parser, OP_RETURN);
 }
 
-static void printStatement()
+static void printStatement(Parser *parser)
 {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    emitByte(OP_PRINT);
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+    emitByte(parser, OP_PRINT);
 }
 
-static void synchronize()
+static void synchronize(Parser *parser)
 {
-    parser.panicMode = false;
+    parser->panicMode = false;
 
-    while (parser.current.type != TOKEN_EOF)
+    while (parser->current.type != TOKEN_EOF)
     {
-        if (parser.previous.type == TOKEN_SEMICOLON)
+        if (parser->previous.type == TOKEN_SEMICOLON)
         {
             return;
         }
 
-        switch (parser.current.type)
+        switch (parser->current.type)
         {
         case TOKEN_CLASS:
         case TOKEN_FUN:
@@ -347,144 +1021,164 @@ static void synchronize()
         default:;
         }
 
-        advance();
+        advance(parser);
     }
 }
 
-static void declaration()
+static void declaration(Parser *parser)
 {
-    if (match(TOKEN_VAR))
+    if (match(parser, TOKEN_FUN))
+    {
+        funDeclaration(parser);
+    }
+    else if (match(parser, TOKEN_VAR))
     {
-        varDeclaration();
+        varDeclaration(parser);
     }
     else
     {
-        statement();
+        statement(parser);
     }
 
-    if (parser.panicMode)
+    if (parser->panicMode)
     {
-        synchronize();
+        synchronize(parser);
     }
 }
 
-static void statement()
+static void statement(Parser *parser)
 {
-    if (match(TOKEN_PRINT))
+    if (match(parser, TOKEN_PRINT))
     {
-        printStatement();
+        printStatement(parser);
+    }
+    else if (match(parser, TOKEN_RETURN))
+    {
+        returnStatement(parser);
+    }
+    else if (match(parser, TOKEN_FOR))
+    {
+        forStatement(parser);
+    }
+    else if (match(parser, TOKEN_IF))
+    {
+        ifStatement(parser);
+    }
+    else if (match(parser, TOKEN_WHILE))
+    {
+        whileStatement(parser);
+    }
+    else if (match(parser, TOKEN_LEFT_BRACE))
+    {
+        beginScope(parser);
+        block(parser);
+        endScope(parser);
     }
     else
     {
-        expressionStatement();
+        expressionStatement(parser);
     }
 }
 
-static void grouping(bool canAssign)
+static void grouping(Parser *parser, bool canAssign)
 {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void emitConstant(Value value)
+static void emitConstant(Parser *parser, Value value)
 {
-    int constant = makeConstant(value);
-    if (constant <= UINT8_MAX)
-    {
-        emitByte(OP_CONSTANT);
-        emitByte((uint8_t)constant);
-    }
-    else if (constant <= UINT16_MAX)
-    {
-        emitByte(OP_CONSTANT_LONG);
-        uint8_t a = (constant - 1) & 0xFF;
-        uint8_t b = (constant - 1) >> 8;
-        emitBytes(a, b);
-    }
-    else
+    emitIndexed(parser, OP_CONSTANT, OP_CONSTANT_LONG, makeConstant(parser, value));
+}
+
+static void number(Parser *parser, bool canAssign)
+{
+    int64_t integer;
+    parser->lastType = TYPE_NUMBER;
+    if (parseInteger(parser->previous.start, parser->previous.length, &integer))
     {
-        error("Too many constants in one chunk.");
+        emitConstant(parser, INT_VAL(integer));
+        return;
     }
+    double value = parseNumber(parser->previous.start, parser->previous.length);
+    emitConstant(parser, NUMBER_VAL(value));
 }
 
-static void number(bool canAssign)
+static void string(Parser *parser, bool canAssign)
 {
-    double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+    emitConstant(parser, OBJ_VAL(copyString(parser->vm, parser->previous.start + 1,
+                                    parser->previous.length - 2)));
+    parser->lastType = TYPE_STRING;
 }
 
-static void string(bool canAssign)
+static void localVariable(Parser *parser, int slot, bool canAssign)
 {
-    emitConstant(OBJ_VAL(copyString(parser.previous.start + 1,
-                                    parser.previous.length - 2)));
+    bool assign = canAssign && match(parser, TOKEN_EQUAL);
+    if (assign)
+    {
+        expression(parser);
+    }
+    if (slot <= UINT8_MAX)
+    {
+        emitBytes(parser, assign ? OP_SET_LOCAL : OP_GET_LOCAL, (uint8_t)slot);
+    }
+    else
+    {
+        emitByte(parser, assign ? OP_SET_LOCAL_LONG : OP_GET_LOCAL_LONG);
+        emitBytes(parser, slot & 0xFF, slot >> 8);
+    }
 }
 
-static void namedVariable(Token name, bool canAssign)
+static void namedVariable(Parser *parser, Token name, bool canAssign)
 {
-    int arg = identifierConstant(&name);
-    if (arg <= UINT8_MAX)
+    int slot = resolveLocal(parser, &name);
+    if (slot != -1)
     {
-        if (canAssign && match(TOKEN_EQUAL))
-        {
-            expression();
-            emitByte(OP_SET_GLOBAL);
-        }
-        else
-        {
-            emitByte(OP_GET_GLOBAL);
-        }
-
-        emitByte((uint8_t)arg);
+        localVariable(parser, slot, canAssign);
+        return;
     }
-    else if (arg <= UINT16_MAX)
+    int arg = identifierConstant(parser, &name);
+    if (canAssign && match(parser, TOKEN_EQUAL))
     {
-        if (canAssign && match(TOKEN_EQUAL))
-        {
-            expression();
-            emitByte(OP_SET_GLOBAL_LONG);
-        }
-        else
-        {
-            emitByte(OP_GET_GLOBAL_LONG);
-        }
-        uint8_t a = (arg - 1) & 0xFF;
-        uint8_t b = (arg - 1) >> 8;
-        emitBytes(a, b);
+        expression(parser);
+        emitIndexed(parser, OP_SET_GLOBAL, OP_SET_GLOBAL_LONG, arg);
     }
     else
     {
-        error("Too many constants in one chunk.");
+        emitIndexed(parser, OP_GET_GLOBAL, OP_GET_GLOBAL_LONG, arg);
     }
 }
 
-static void variable(bool canAssign)
+static void variable(Parser *parser, bool canAssign)
 {
-    namedVariable(parser.previous, canAssign);
+    namedVariable(parser, parser->previous, canAssign);
 }
 
-static void unary(bool canAssign)
+static void unary(Parser *parser, bool canAssign)
 {
-    TokenType operatorType = parser.previous.type;
+    TokenType operatorType = parser->previous.type;
 
     // Compile the operand.
-    parsePrecedence(PREC_UNARY);
+    parsePrecedence(parser, PREC_UNARY);
 
     // Emit the operator instruction.
     switch (operatorType)
     {
     case TOKEN_BANG:
-        emitByte(OP_NOT);
+        emitByte(parser, OP_NOT);
+        parser->lastType = TYPE_BOOL;
         break;
     case TOKEN_MINUS:
-        emitByte(OP_NEGATE);
+        emitByte(parser, OP_NEGATE);
+        parser->lastType = TYPE_NUMBER;
         break;
     default:
         return; // Unreachable.
     }
 }
 
-ParseRule rules[] = {
-    {grouping, NULL, PREC_CALL},     // TOKEN_LEFT_PARENg
+static ParseRule rules[] = {
+    {grouping, call, PREC_CALL},     // TOKEN_LEFT_PAREN
     {NULL, NULL, PREC_NONE},         // TOKEN_RIGHT_PAREN
     {NULL, NULL, PREC_NONE},         // TOKEN_LEFT_BRACE
     {NULL, NULL, PREC_NONE},         // TOKEN_RIGHT_BRACE
@@ -506,7 +1200,7 @@ ParseRule rules[] = {
     {variable, NULL, PREC_NONE},     // TOKEN_IDENTIFIER
     {string, NULL, PREC_NONE},       // TOKEN_STRING
     {number, NULL, PREC_NONE},       // TOKEN_NUMBER
-    {NULL, NULL, PREC_AND},          // TOKEN_AND
+    {NULL, and_, PREC_AND},          // TOKEN_AND
     {NULL, NULL, PREC_NONE},         // TOKEN_CLASS
     {NULL, NULL, PREC_NONE},         // TOKEN_ELSE
     {literal, NULL, PREC_NONE},      // TOKEN_FALSE
@@ -514,7 +1208,7 @@ ParseRule rules[] = {
     {NULL, NULL, PREC_NONE},         // TOKEN_FOR
     {NULL, NULL, PREC_NONE},         // TOKEN_IF
     {literal, NULL, PREC_NONE},      // TOKEN_NIL
-    {NULL, NULL, PREC_OR},           // TOKEN_OR
+    {NULL, or_, PREC_OR},            // TOKEN_OR
     {NULL, NULL, PREC_NONE},         // TOKEN_PRINT
     {NULL, NULL, PREC_NONE},         // TOKEN_RETURN
     {NULL, NULL, PREC_NONE},         // TOKEN_SUPER
@@ -531,18 +1225,73 @@ static ParseRule *getRule(TokenType type)
     return &rules[type];
 }
 
-bool compile(const char *source, Chunk *chunk)
+static bool compileScanned(VM *vm, Parser *parser, Chunk *chunk)
 {
-    initScanner(source);
-    compilingChunk = chunk;
-    parser.hadError = false;
-    parser.panicMode = false;
-    advance();
-    while (!match(TOKEN_EOF))
+    uint64_t start = statsNow();
+    parser->vm = vm;
+    parser->compiler = NULL;
+    parser->hadError = false;
+    parser->panicMode = false;
+    parser->chainStart = -1;
+    parser->chainEnd = -1;
+    parser->chainLength = 0;
+    parser->lastType = TYPE_UNKNOWN;
+    parser->compareStart = -1;
+    parser->compareEnd = -1;
+    parser->callEnd = -1;
+    Compiler compiler;
+    initCompiler(parser, &compiler, TYPE_SCRIPT, chunk);
+    advance(parser);
+    while (!match(parser, TOKEN_EOF))
     {
-        declaration();
+        declaration(parser);
     }
 
-    endCompiler();
-    return !parser.hadError;
-}
\ No newline at end of file
+    endCompiler(parser);
+    vm->stats.compileNs += statsNow() - start;
+    vm->stats.sourceBytes += parser->scanner.length;
+    statsChunk(&vm->stats, chunk);
+    return !parser->hadError;
+}
+
+static void timeScanner(VM *vm, const char *source, size_t length)
+{
+    Scanner scanner;
+    initScanner(&scanner, source, length);
+    uint64_t start = statsNow();
+    while (scanToken(&scanner).type != TOKEN_EOF)
+    {
+    }
+    vm->stats.scanNs += statsNow() - start;
+    vm->stats.scannedBytes += length;
+}
+
+bool compile(VM *vm, const char *source, size_t length, Chunk *chunk, Arena *arena)
+{
+    if (vm->stats.timeScanning)
+    {
+        timeScanner(vm, source, length);
+    }
+    Parser parser;
+    initScanner(&parser.scanner, source, length);
+    if (arena != NULL)
+    {
+        // Huge sources grow the chunk instead of reserving it all upfront.
+        size_t sized = length < COMPILE_RESERVE_MAX ? length : COMPILE_RESERVE_MAX;
+        reserveChunk(chunk, arena, (int)sized);
+    }
+    return compileScanned(vm, &parser, chunk);
+}
+
+bool compileStream(VM *vm, FILE *stream, Chunk *chunk, Arena *arena)
+{
+    Parser parser;
+    initStreamScanner(&parser.scanner, stream);
+    if (arena != NULL)
+    {
+        reserveChunk(chunk, arena, SCAN_STREAM_SIZE);
+    }
+    bool success = compileScanned(vm, &parser, chunk);
+    freeScanner(&parser.scanner);
+    return success;
+}
@@ -1,9 +1,19 @@
 #ifndef clox_compiler_h
 #define clox_compiler_h
 
+#include <stdio.h>
+
 #include "object.h"
 #include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+// The most source compile() sizes the chunk for upfront.
+#define COMPILE_RESERVE_MAX (64 * 1024 * 1024)
+
+// Without an arena the chunk is grown on the VM heap and outlives the
+// compile until freeChunk(). The source needs no terminator and is not
+// used once compiling is done. compileStream() reads the source from
+// stream in bounded pieces until the end of the stream.
+bool compile(VM *vm, const char *source, size_t length, Chunk *chunk, Arena *arena);
+bool compileStream(VM *vm, FILE *stream, Chunk *chunk, Arena *arena);
 
 #endif
\ No newline at end of file
@@ -26,6 +26,24 @@ static int constantInstruction(const char *name, Chunk *chunk,
     printf("'\n");
     return offset + 2;
 }
+static int byteInstruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t operand = chunk->code[offset + 1];
+    printf("%-16s %4d\n", name, operand);
+    return offset + 2;
+}
+static int shortInstruction(const char *name, Chunk *chunk, int offset)
+{
+    uint16_t operand = (uint16_t)(chunk->code[offset + 1] | (chunk->code[offset + 2] << 8));
+    printf("%-16s %4d\n", name, operand);
+    return offset + 3;
+}
+static int jumpInstruction(const char *name, int sign, Chunk *chunk, int offset)
+{
+    uint16_t jump = (uint16_t)(chunk->code[offset + 1] | (chunk->code[offset + 2] << 8));
+    printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+    return offset + 3;
+}
 static int longconstantInstruction(const char *name, Chunk *chunk,
                                    int offset)
 {
@@ -37,6 +55,16 @@ static int longconstantInstruction(const char *name, Chunk *chunk,
     printf("'\n");
     return offset + 3;
 }
+// Prints the prefixed instruction's name after the prefix's.
+static int wideInstruction(Chunk *chunk, int offset)
+{
+    int constant = chunk->code[offset + 2] | (chunk->code[offset + 3] << 8) |
+                   (chunk->code[offset + 4] << 16);
+    printf("OP_WIDE %-16s %4d '", opcodeName(chunk->code[offset + 1]), constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 5;
+}
 int disassembleInstruction(Chunk *chunk, int offset)
 {
     printf("%04d ", offset);
@@ -98,6 +126,56 @@ int disassembleInstruction(Chunk *chunk, int offset)
         return constantInstruction("OP_SET_GLOBAL", chunk, offset);
     case OP_SET_GLOBAL_LONG:
         return longconstantInstruction("OP_SET_GLOBAL_LONG", chunk, offset);
+    case OP_CONCAT_N:
+        return byteInstruction("OP_CONCAT_N", chunk, offset);
+    case OP_ADD_NN:
+        return simpleInstruction("OP_ADD_NN", offset);
+    case OP_SUBTRACT_NN:
+        return simpleInstruction("OP_SUBTRACT_NN", offset);
+    case OP_MULTIPLY_NN:
+        return simpleInstruction("OP_MULTIPLY_NN", offset);
+    case OP_DIVIDE_NN:
+        return simpleInstruction("OP_DIVIDE_NN", offset);
+    case OP_LESS_NN:
+        return simpleInstruction("OP_LESS_NN", offset);
+    case OP_GREATER_NN:
+        return simpleInstruction("OP_GREATER_NN", offset);
+    case OP_GET_LOCAL:
+        return byteInstruction("OP_GET_LOCAL", chunk, offset);
+    case OP_GET_LOCAL_LONG:
+        return shortInstruction("OP_GET_LOCAL_LONG", chunk, offset);
+    case OP_SET_LOCAL:
+        return byteInstruction("OP_SET_LOCAL", chunk, offset);
+    case OP_SET_LOCAL_LONG:
+        return shortInstruction("OP_SET_LOCAL_LONG", chunk, offset);
+    case OP_POPN:
+        return byteInstruction("OP_POPN", chunk, offset);
+    case OP_CALL:
+        return byteInstruction("OP_CALL", chunk, offset);
+    case OP_TAIL_CALL:
+        return byteInstruction("OP_TAIL_CALL", chunk, offset);
+    case OP_JUMP:
+        return jumpInstruction("OP_JUMP", 1, chunk, offset);
+    case OP_JUMP_IF_FALSE:
+        return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_POP_JUMP_IF_FALSE:
+        return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_LOOP:
+        return jumpInstruction("OP_LOOP", -1, chunk, offset);
+    case OP_JUMP_IF_NOT_LESS:
+        return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_GREATER:
+        return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset);
+    case OP_JUMP_IF_LESS:
+        return jumpInstruction("OP_JUMP_IF_LESS", 1, chunk, offset);
+    case OP_JUMP_IF_GREATER:
+        return jumpInstruction("OP_JUMP_IF_GREATER", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_EQUAL:
+        return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", 1, chunk, offset);
+    case OP_JUMP_IF_EQUAL:
+        return jumpInstruction("OP_JUMP_IF_EQUAL", 1, chunk, offset);
+    case OP_WIDE:
+        return wideInstruction(chunk, offset);
     default:
         printf("Unknown opcode %d\n", instruction);
         return offset + 1;
@@ -110,11 +188,115 @@ int getLine(Chunk *chunk, int offset)
     for (int x = 0; x < chunk->linecount; x++)
     {
         y += chunk->linecounter[x];
-        if (y >= offset)
+        if (y > offset)
         {
             return chunk->lines[x];
         }
     }
     return 0;
     printf("Line information corrupted\n");
-}
\ No newline at end of file
+}
+
+const char *opcodeName(int opcode)
+{
+    switch (opcode)
+    {
+    case OP_CONSTANT:
+        return "OP_CONSTANT";
+    case OP_RETURN:
+        return "OP_RETURN";
+    case OP_CONSTANT_LONG:
+        return "OP_CONSTANT_LONG";
+    case OP_NIL:
+        return "OP_NIL";
+    case OP_TRUE:
+        return "OP_TRUE";
+    case OP_FALSE:
+        return "OP_FALSE";
+    case OP_EQUAL:
+        return "OP_EQUAL";
+    case OP_GREATER:
+        return "OP_GREATER";
+    case OP_LESS:
+        return "OP_LESS";
+    case OP_NEGATE:
+        return "OP_NEGATE";
+    case OP_ADD:
+        return "OP_ADD";
+    case OP_SUBTRACT:
+        return "OP_SUBTRACT";
+    case OP_MULTIPLY:
+        return "OP_MULTIPLY";
+    case OP_DIVIDE:
+        return "OP_DIVIDE";
+    case OP_NOT:
+        return "OP_NOT";
+    case OP_PRINT:
+        return "OP_PRINT";
+    case OP_POP:
+        return "OP_POP";
+    case OP_DEFINE_GLOBAL:
+        return "OP_DEFINE_GLOBAL";
+    case OP_DEFINE_GLOBAL_LONG:
+        return "OP_DEFINE_GLOBAL_LONG";
+    case OP_GET_GLOBAL:
+        return "OP_GET_GLOBAL";
+    case OP_GET_GLOBAL_LONG:
+        return "OP_GET_GLOBAL_LONG";
+    case OP_SET_GLOBAL:
+        return "OP_SET_GLOBAL";
+    case OP_SET_GLOBAL_LONG:
+        return "OP_SET_GLOBAL_LONG";
+    case OP_CONCAT_N:
+        return "OP_CONCAT_N";
+    case OP_ADD_NN:
+        return "OP_ADD_NN";
+    case OP_SUBTRACT_NN:
+        return "OP_SUBTRACT_NN";
+    case OP_MULTIPLY_NN:
+        return "OP_MULTIPLY_NN";
+    case OP_DIVIDE_NN:
+        return "OP_DIVIDE_NN";
+    case OP_LESS_NN:
+        return "OP_LESS_NN";
+    case OP_GREATER_NN:
+        return "OP_GREATER_NN";
+    case OP_GET_LOCAL:
+        return "OP_GET_LOCAL";
+    case OP_GET_LOCAL_LONG:
+        return "OP_GET_LOCAL_LONG";
+    case OP_SET_LOCAL:
+        return "OP_SET_LOCAL";
+    case OP_SET_LOCAL_LONG:
+        return "OP_SET_LOCAL_LONG";
+    case OP_POPN:
+        return "OP_POPN";
+    case OP_CALL:
+        return "OP_CALL";
+    case OP_TAIL_CALL:
+        return "OP_TAIL_CALL";
+    case OP_JUMP:
+        return "OP_JUMP";
+    case OP_JUMP_IF_FALSE:
+        return "OP_JUMP_IF_FALSE";
+    case OP_POP_JUMP_IF_FALSE:
+        return "OP_POP_JUMP_IF_FALSE";
+    case OP_LOOP:
+        return "OP_LOOP";
+    case OP_JUMP_IF_NOT_LESS:
+        return "OP_JUMP_IF_NOT_LESS";
+    case OP_JUMP_IF_NOT_GREATER:
+        return "OP_JUMP_IF_NOT_GREATER";
+    case OP_JUMP_IF_LESS:
+        return "OP_JUMP_IF_LESS";
+    case OP_JUMP_IF_GREATER:
+        return "OP_JUMP_IF_GREATER";
+    case OP_JUMP_IF_NOT_EQUAL:
+        return "OP_JUMP_IF_NOT_EQUAL";
+    case OP_JUMP_IF_EQUAL:
+        return "OP_JUMP_IF_EQUAL";
+    case OP_WIDE:
+        return "OP_WIDE";
+    }
+    return "OP_UNKNOWN";
+}
@@ -6,5 +6,6 @@
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int i);
 int getLine(Chunk * chunk,int offset);
+const char *opcodeName(int opcode);
 
 #endif
\ No newline at end of file
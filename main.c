@@ -1,55 +1,103 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "common.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
+#include "scheduler.h"
+#include "server.h"
 #include "vm.h"
 
-static char *readFile(const char *path)
+// A script is read through a read-only mapping when it is a regular file
+// and streamed otherwise, so pipes and "-" for stdin work and no file is
+// ever copied whole into memory.
+typedef struct
 {
-    FILE *file = fopen(path, "rb");
-    if (file == NULL)
+    FILE *file;
+    char *mapped; // NULL when streamed.
+    size_t length;
+} SourceFile;
+
+static void openSource(SourceFile *source, const char *path)
+{
+    source->file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (source->file == NULL)
     {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
         exit(74);
     }
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
+    source->mapped = NULL;
+    source->length = 0;
 
-    char *buffer = (char *)malloc(fileSize + 1);
-    if (buffer == NULL)
+    // Empty files cannot be mapped and stream just as well.
+    struct stat info;
+    int fd = fileno(source->file);
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
     {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+        return;
     }
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    if (bytesRead < fileSize)
+    void *mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED)
     {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
-        exit(74);
+        madvise(mapped, (size_t)info.st_size, MADV_SEQUENTIAL);
+        source->mapped = (char *)mapped;
+        source->length = (size_t)info.st_size;
     }
-    buffer[bytesRead] = '\0';
+}
 
-    fclose(file);
-    return buffer;
+static void closeSource(SourceFile *source)
+{
+    if (source->mapped != NULL)
+    {
+        munmap(source->mapped, source->length);
+    }
+    if (source->file != stdin)
+    {
+        fclose(source->file);
+    }
 }
 
-static void runFile(const char *path)
+static InterpretResult runFile(VM *vm, const char *path)
 {
-    char *source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+    SourceFile source;
+    openSource(&source, path);
+    InterpretResult result = source.mapped != NULL ? interpret(vm, source.mapped, source.length)
+                                                   : interpretStream(vm, source.file);
+    closeSource(&source);
+    return result;
+}
 
-    if (result == INTERPRET_COMPILE_ERROR)
-        exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR)
-        exit(70);
+// Runs every script interleaved in the scheduler and reports how the
+// slices went on stderr.
+static InterpretResult scheduleFiles(const char **paths, int count, uint64_t fuel)
+{
+    Scheduler scheduler;
+    initScheduler(&scheduler, fuel);
+    bool compiled = true;
+    for (int i = 0; i < count; i++)
+    {
+        SourceFile source;
+        openSource(&source, paths[i]);
+        bool spawned = source.mapped != NULL ? spawnTask(&scheduler, source.mapped, source.length)
+                                             : spawnStreamTask(&scheduler, source.file);
+        compiled = spawned && compiled;
+        closeSource(&source);
+    }
+    runScheduler(&scheduler);
+    reportScheduler(&scheduler, stderr);
+
+    if (!compiled)
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+    return scheduler.errors > 0 ? INTERPRET_RUNTIME_ERROR : INTERPRET_OK;
 }
 
-static void repl()
+static void repl(VM *vm)
 {
     char line[1024];
     for (;;)
@@ -65,27 +113,120 @@ static void repl()
         {
             break;
         }
-        interpret(line);
+        interpret(vm, line, strlen(line));
     }
 }
 
+static void usage()
+{
+    fprintf(stderr, "Usage: clox [--bench] [--stats] [path | -]\n");
+    fprintf(stderr, "       clox --schedule [--fuel instructions] path...\n");
+    fprintf(stderr, "       clox --serve socket [--cache]\n");
+    exit(64);
+}
+
 int main(int argc, const char *argv[])
 {
-    initVM();
-    if (argc == 1)
+    const char *socketPath = NULL;
+    bool cacheChunks = false;
+    bool bench = false;
+    bool stats = false;
+    bool schedule = false;
+    uint64_t fuel = SCHEDULER_DEFAULT_FUEL;
+    const char **paths = (const char **)malloc(sizeof(const char *) * argc);
+    int pathCount = 0;
+    for (int i = 1; i < argc; i++)
     {
-        repl();
+        if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+        {
+            socketPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache") == 0)
+        {
+            cacheChunks = true;
+        }
+        else if (strcmp(argv[i], "--bench") == 0)
+        {
+            bench = true;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            stats = true;
+        }
+        else if (strcmp(argv[i], "--schedule") == 0)
+        {
+            schedule = true;
+        }
+        else if (strcmp(argv[i], "--fuel") == 0 && i + 1 < argc)
+        {
+            fuel = strtoull(argv[++i], NULL, 10);
+            if (fuel == 0)
+            {
+                usage();
+            }
+        }
+        else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)
+        {
+            paths[pathCount++] = argv[i];
+        }
+        else
+        {
+            usage();
+        }
     }
-    else if (argc == 2)
+
+    if (socketPath != NULL)
     {
-        runFile(argv[1]);
+        if (pathCount > 0)
+        {
+            usage();
+        }
+        return serve(socketPath, cacheChunks);
+    }
+
+    InterpretResult result = INTERPRET_OK;
+    if (schedule)
+    {
+        if (pathCount == 0 || bench || stats)
+        {
+            usage();
+        }
+        result = scheduleFiles(paths, pathCount, fuel);
     }
     else
     {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        if (pathCount > 1)
+        {
+            usage();
+        }
+        VM vm;
+        initVM(&vm);
+        vm.stats.timeScanning = stats;
+        if (pathCount == 0)
+        {
+            repl(&vm);
+        }
+        else
+        {
+            result = runFile(&vm, paths[0]);
+        }
+
+        VMStats totals = getStats(&vm);
+        if (bench)
+        {
+            reportBenchStats(&totals, stderr);
+        }
+        if (stats)
+        {
+            reportStats(&totals, stderr);
+        }
+        freeVM(&vm);
     }
+    free(paths);
 
-    freeVM();
+    if (result == INTERPRET_COMPILE_ERROR)
+        return 65;
+    if (result == INTERPRET_RUNTIME_ERROR)
+        return 70;
     return 0;
 }
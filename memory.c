@@ -1,11 +1,16 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "memory.h"
+#include "profiler.h"
 #include "vm.h"
 
-void *reallocate(void *previous, size_t oldSize, size_t newSize)
+#ifdef NO_OBJECT_POOL
+static void *reallocateBlock(VM *vm, void *previous, size_t oldSize, size_t newSize)
 {
+    (void)vm;
+    (void)oldSize;
     if (newSize == 0)
     {
         free(previous);
@@ -14,26 +19,105 @@ void *reallocate(void *previous, size_t oldSize, size_t newSize)
 
     return realloc(previous, newSize);
 }
+#else
+// Every block small enough for the pool lives in the pool, so oldSize
+// alone tells where previous came from. Callers must pass exact sizes.
+static void *reallocateBlock(VM *vm, void *previous, size_t oldSize, size_t newSize)
+{
+    bool fromPool = previous != NULL && poolHandles(oldSize);
+
+    if (newSize == 0)
+    {
+        if (fromPool)
+        {
+            poolFree(&vm->pool, previous, oldSize);
+        }
+        else
+        {
+            free(previous);
+        }
+        return NULL;
+    }
+
+    if (poolHandles(newSize))
+    {
+        if (fromPool && poolClass(oldSize) == poolClass(newSize))
+        {
+            return previous;
+        }
+        void *result = poolAllocate(&vm->pool, newSize);
+        if (previous != NULL)
+        {
+            memcpy(result, previous, oldSize < newSize ? oldSize : newSize);
+            reallocateBlock(vm, previous, oldSize, 0);
+        }
+        return result;
+    }
 
-static void freeObject(Obj *object)
+    if (fromPool)
+    {
+        void *result = malloc(newSize);
+        if (result == NULL)
+        {
+            return NULL;
+        }
+        memcpy(result, previous, oldSize);
+        poolFree(&vm->pool, previous, oldSize);
+        return result;
+    }
+
+    return realloc(previous, newSize);
+}
+#endif
+
+void *reallocate(VM *vm, void *previous, size_t oldSize, size_t newSize)
+{
+#ifdef PROFILE_ALLOCATIONS
+    if (newSize > oldSize)
+    {
+        profileAllocation(&vm->allocations, newSize);
+    }
+#endif
+    statsAllocate(&vm->stats, oldSize, newSize);
+    return reallocateBlock(vm, previous, oldSize, newSize);
+}
+
+static void freeObject(VM *vm, Obj *object)
 {
     switch (object->type)
     {
+    case OBJ_FLOAT64_ARRAY:
+    {
+        ObjFloat64Array *array = (ObjFloat64Array *)object;
+        reallocate(vm, object, FLOAT64_ARRAY_SIZE(array->length), 0);
+        break;
+    }
+    case OBJ_FUNCTION:
+    {
+        ObjFunction *function = (ObjFunction *)object;
+        freeChunk(vm, &function->chunk);
+        FREE(vm, ObjFunction, object);
+        break;
+    }
+    case OBJ_NATIVE:
+        FREE(vm, ObjNative, object);
+        break;
     case OBJ_STRING:
     {
-        FREE(ObjString, object);
+        ObjString *string = (ObjString *)object;
+        reallocate(vm, object, sizeof(ObjString) + string->length + 1, 0);
         break;
     }
     }
 }
 
-void freeObjects()
+void freeObjects(VM *vm)
 {
-    Obj *object = vm.objects;
+    Obj *object = vm->objects;
     while (object != NULL)
     {
         Obj *next = object->next;
-        freeObject(object);
+        freeObject(vm, object);
         object = next;
     }
 }
\ No newline at end of file
@@ -3,23 +3,23 @@
 #include "common.h"
 #include "object.h"
 
-#define ALLOCATE(type, count) \
-    (type *)reallocate(NULL, 0, sizeof(type) * (count))
+#define ALLOCATE(vm, type, count) \
+    (type *)reallocate(vm, NULL, 0, sizeof(type) * (count))
 
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity)*2)
 
-#define GROW_ARRAY(previous, type, oldCount, count)         \
-    (type *)reallocate(previous, sizeof(type) * (oldCount), \
+#define GROW_ARRAY(vm, previous, type, oldCount, count)         \
+    (type *)reallocate(vm, previous, sizeof(type) * (oldCount), \
                        sizeof(type) * (count))
 
-#define FREE(type, pointer) \
-    reallocate(pointer, sizeof(type), 0)
+#define FREE(vm, type, pointer) \
+    reallocate(vm, pointer, sizeof(type), 0)
 
-#define FREE_ARRAY(type, pointer, oldCount) \
-    reallocate(pointer, sizeof(type) * (oldCount), 0)
+#define FREE_ARRAY(vm, type, pointer, oldCount) \
+    reallocate(vm, pointer, sizeof(type) * (oldCount), 0)
 
-void *reallocate(void *previous, size_t oldSize, size_t newSize);
-void freeObjects();
+void *reallocate(VM *vm, void *previous, size_t oldSize, size_t newSize);
+void freeObjects(VM *vm);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,309 @@
+#include <string.h>
+
+#include "native.h"
+#include "object.h"
+#include "simd.h"
+#include "table.h"
+#include "vm.h"
+
+// Float64Array natives. Element-wise work runs in the kernels of simd.c
+// instead of one dispatch per element. The in-place operations return
+// the array they changed.
+
+static bool arrayArgument(VM *vm, Value value, ObjFloat64Array **array)
+{
+    if (!IS_FLOAT64_ARRAY(value))
+    {
+        runtimeError(vm, "Expected a Float64Array.");
+        return false;
+    }
+    *array = AS_FLOAT64_ARRAY(value);
+    return true;
+}
+
+static bool numberArgument(VM *vm, Value value, double *number)
+{
+    if (!IS_NUMERIC(value))
+    {
+        runtimeError(vm, "Expected a number.");
+        return false;
+    }
+    *number = AS_DOUBLE(value);
+    return true;
+}
+
+// Integral doubles count as integers, so 2.0 indexes like 2.
+static bool integerArgument(VM *vm, Value value, int64_t *integer)
+{
+    double number;
+    if (IS_INT(value))
+    {
+        *integer = AS_INT(value);
+        return true;
+    }
+    if (!numberArgument(vm, value, &number))
+    {
+        return false;
+    }
+    // Out-of-range casts are undefined, so the bounds come first.
+    if (!(number >= -9223372036854775808.0 && number < 9223372036854775808.0))
+    {
+        runtimeError(vm, "Expected an integer.");
+        return false;
+    }
+    int64_t whole = (int64_t)number;
+    if ((double)whole < number || (double)whole > number)
+    {
+        runtimeError(vm, "Expected an integer.");
+        return false;
+    }
+    *integer = whole;
+    return true;
+}
+
+static bool indexArgument(VM *vm, ObjFloat64Array *array, Value value, int *index)
+{
+    int64_t integer;
+    if (!integerArgument(vm, value, &integer))
+    {
+        return false;
+    }
+    if (integer < 0 || integer >= array->length)
+    {
+        runtimeError(vm, "Index %lld out of bounds for length %d.", (long long)integer, array->length);
+        return false;
+    }
+    *index = (int)integer;
+    return true;
+}
+
+static bool sameLengthArguments(VM *vm, Value *args, ObjFloat64Array **a, ObjFloat64Array **b)
+{
+    if (!arrayArgument(vm, args[0], a) || !arrayArgument(vm, args[1], b))
+    {
+        return false;
+    }
+    if ((*a)->length != (*b)->length)
+    {
+        runtimeError(vm, "Array lengths differ: %d and %d.", (*a)->length, (*b)->length);
+        return false;
+    }
+    return true;
+}
+
+static bool float64ArrayNative(VM *vm, Value *args, Value *result)
+{
+    int64_t length;
+    if (!integerArgument(vm, args[0], &length))
+    {
+        return false;
+    }
+    if (length < 0 || length > FLOAT64_ARRAY_MAX)
+    {
+        runtimeError(vm, "Array length must be between 0 and %d.", FLOAT64_ARRAY_MAX);
+        return false;
+    }
+    *result = OBJ_VAL(newFloat64Array(vm, (int)length));
+    return true;
+}
+
+static bool arrayLengthNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *array;
+    if (!arrayArgument(vm, args[0], &array))
+    {
+        return false;
+    }
+    *result = INT_VAL(array->length);
+    return true;
+}
+
+static bool arrayGetNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *array;
+    int index;
+    if (!arrayArgument(vm, args[0], &array) || !indexArgument(vm, array, args[1], &index))
+    {
+        return false;
+    }
+    *result = NUMBER_VAL(array->values[index]);
+    return true;
+}
+
+static bool arraySetNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *array;
+    int index;
+    double number;
+    if (!arrayArgument(vm, args[0], &array) || !indexArgument(vm, array, args[1], &index) ||
+        !numberArgument(vm, args[2], &number))
+    {
+        return false;
+    }
+    array->values[index] = number;
+    *result = args[2];
+    return true;
+}
+
+static bool arrayFillNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *array;
+    double number;
+    if (!arrayArgument(vm, args[0], &array) || !numberArgument(vm, args[1], &number))
+    {
+        return false;
+    }
+    for (int i = 0; i < array->length; i++)
+    {
+        array->values[i] = number;
+    }
+    *result = args[0];
+    return true;
+}
+
+static bool arraySumNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *array;
+    if (!arrayArgument(vm, args[0], &array))
+    {
+        return false;
+    }
+    *result = NUMBER_VAL(simdSum(array->values, array->length));
+    return true;
+}
+
+static bool arrayDotNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *a;
+    ObjFloat64Array *b;
+    if (!sameLengthArguments(vm, args, &a, &b))
+    {
+        return false;
+    }
+    *result = NUMBER_VAL(simdDot(a->values, b->values, a->length));
+    return true;
+}
+
+// The minimum and maximum of an empty array are nil.
+static bool arrayMinNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *array;
+    if (!arrayArgument(vm, args[0], &array))
+    {
+        return false;
+    }
+    *result = array->length == 0 ? NIL_VAL : NUMBER_VAL(simdMin(array->values, array->length));
+    return true;
+}
+
+static bool arrayMaxNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *array;
+    if (!arrayArgument(vm, args[0], &array))
+    {
+        return false;
+    }
+    *result = array->length == 0 ? NIL_VAL : NUMBER_VAL(simdMax(array->values, array->length));
+    return true;
+}
+
+static bool arrayScaleNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *array;
+    double factor;
+    if (!arrayArgument(vm, args[0], &array) || !numberArgument(vm, args[1], &factor))
+    {
+        return false;
+    }
+    simdMap(array->values, array->length, SIMD_MULTIPLY, factor);
+    *result = args[0];
+    return true;
+}
+
+static bool arrayAddNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *a;
+    ObjFloat64Array *b;
+    if (!sameLengthArguments(vm, args, &a, &b))
+    {
+        return false;
+    }
+    simdAdd(a->values, b->values, a->length);
+    *result = args[0];
+    return true;
+}
+
+static bool arrayPrefixSumNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *array;
+    if (!arrayArgument(vm, args[0], &array))
+    {
+        return false;
+    }
+    simdPrefixSum(array->values, array->length);
+    *result = args[0];
+    return true;
+}
+
+// arrayMap(array, "*", 2) applies one arithmetic operator with a number
+// to every element.
+static bool arrayMapNative(VM *vm, Value *args, Value *result)
+{
+    ObjFloat64Array *array;
+    double operand;
+    if (!arrayArgument(vm, args[0], &array) || !numberArgument(vm, args[2], &operand))
+    {
+        return false;
+    }
+
+    SimdOp op;
+    const char *name = IS_STRING(args[1]) ? AS_CSTRING(args[1]) : "";
+    if (strcmp(name, "+") == 0)
+    {
+        op = SIMD_ADD;
+    }
+    else if (strcmp(name, "-") == 0)
+    {
+        op = SIMD_SUBTRACT;
+    }
+    else if (strcmp(name, "*") == 0)
+    {
+        op = SIMD_MULTIPLY;
+    }
+    else if (strcmp(name, "/") == 0)
+    {
+        op = SIMD_DIVIDE;
+    }
+    else
+    {
+        runtimeError(vm, "Operator must be \"+\", \"-\", \"*\" or \"/\".");
+        return false;
+    }
+
+    simdMap(array->values, array->length, op, operand);
+    *result = args[0];
+    return true;
+}
+
+static void defineNative(VM *vm, const char *name, int arity, NativeFn function)
+{
+    ObjString *string = copyString(vm, name, (int)strlen(name));
+    tableSet(vm, &vm->globals, OBJ_VAL(string), OBJ_VAL(newNative(vm, string, arity, function)));
+}
+
+void defineNatives(VM *vm)
+{
+    defineNative(vm, "Float64Array", 1, float64ArrayNative);
+    defineNative(vm, "arrayLength", 1, arrayLengthNative);
+    defineNative(vm, "arrayGet", 2, arrayGetNative);
+    defineNative(vm, "arraySet", 3, arraySetNative);
+    defineNative(vm, "arrayFill", 2, arrayFillNative);
+    defineNative(vm, "arraySum", 1, arraySumNative);
+    defineNative(vm, "arrayDot", 2, arrayDotNative);
+    defineNative(vm, "arrayMin", 1, arrayMinNative);
+    defineNative(vm, "arrayMax", 1, arrayMaxNative);
+    defineNative(vm, "arrayScale", 2, arrayScaleNative);
+    defineNative(vm, "arrayAdd", 2, arrayAddNative);
+    defineNative(vm, "arrayPrefixSum", 1, arrayPrefixSumNative);
+    defineNative(vm, "arrayMap", 3, arrayMapNative);
+}
@@ -0,0 +1,9 @@
+#ifndef clox_native_h
+#define clox_native_h
+
+#include "common.h"
+
+// Defines the built-in functions as globals of the VM.
+void defineNatives(VM *vm);
+
+#endif
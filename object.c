@@ -3,39 +3,72 @@
 
 #include "memory.h"
 #include "object.h"
+#include "profiler.h"
 #include "value.h"
 #include "vm.h"
 
-#define ALLOCATE_OBJ(type, objectType) \
-    (type *)allocateObject(sizeof(type), objectType)
+#define ALLOCATE_OBJ(vm, type, objectType) \
+    (type *)allocateObject(vm, sizeof(type), objectType)
 
-static Obj *allocateObject(size_t size, ObjType type)
+static Obj *allocateObject(VM *vm, size_t size, ObjType type)
 {
-    Obj *object = (Obj *)reallocate(NULL, 0, size);
+    PROFILE_KIND(vm, objectTypeName(type));
+    Obj *object = (Obj *)reallocate(vm, NULL, 0, size);
+    PROFILE_KIND(vm, NULL);
     object->type = type;
-    object->next = vm.objects;
-    vm.objects = object;
+    object->next = vm->objects;
+    vm->objects = object;
 
     return object;
 }
 
-static ObjString *allocateString(const char *chars, int length, uint32_t hash)
+static ObjString *allocateString(VM *vm, const char *chars, int length, uint32_t hash)
 {
-    ObjString *string = (ObjString *)allocateObject(sizeof(ObjString) + (length + 1) * sizeof(char), OBJ_STRING);
+    ObjString *string = (ObjString *)allocateObject(vm, sizeof(ObjString) + (length + 1) * sizeof(char), OBJ_STRING);
     string->length = length;
     memcpy(&string->chars, chars, length);
     string->chars[length] = '\0';
     string->hash = hash;
 
-    tableSet(&vm.strings, OBJ_VAL(string), NIL_VAL);
+    tableSet(vm, &vm->strings, OBJ_VAL(string), NIL_VAL);
 
     return string;
 }
 
-static uint32_t hashString(const char *key, int length)
+// The elements start out zeroed.
+ObjFloat64Array *newFloat64Array(VM *vm, int length)
 {
-    uint32_t hash = 2166136261u;
+    ObjFloat64Array *array = (ObjFloat64Array *)allocateObject(vm, FLOAT64_ARRAY_SIZE(length), OBJ_FLOAT64_ARRAY);
+    uintptr_t start = (uintptr_t)(array + 1);
+    start = (start + FLOAT64_ARRAY_ALIGNMENT - 1) & ~(uintptr_t)(FLOAT64_ARRAY_ALIGNMENT - 1);
+    array->length = length;
+    array->values = (double *)start;
+    memset(array->values, 0, (size_t)length * sizeof(double));
+    return array;
+}
+
+ObjFunction *newFunction(VM *vm)
+{
+    ObjFunction *function = ALLOCATE_OBJ(vm, ObjFunction, OBJ_FUNCTION);
+    function->arity = 0;
+    function->name = NULL;
+    initChunk(&function->chunk);
+    return function;
+}
+
+ObjNative *newNative(VM *vm, ObjString *name, int arity, NativeFn function)
+{
+    ObjNative *native = ALLOCATE_OBJ(vm, ObjNative, OBJ_NATIVE);
+    native->arity = arity;
+    native->function = function;
+    native->name = name;
+    return native;
+}
 
+// FNV-1a is streaming: continuing from the hash of a over the bytes of b
+// gives the hash of a + b.
+static uint32_t continueHash(uint32_t hash, const char *key, int length)
+{
     for (int i = 0; i < length; i++)
     {
         hash ^= key[i];
@@ -44,41 +77,96 @@ static uint32_t hashString(const char *key, int length)
     return hash;
 }
 
-ObjString *emptyString(int length)
+uint32_t hashString(const char *key, int length)
+{
+    return continueHash(2166136261u, key, length);
+}
+
+ObjString *emptyString(VM *vm, int length)
 {
-    ObjString *string = (ObjString *)allocateObject(sizeof(ObjString) + (length + 1) * sizeof(char), OBJ_STRING);
+    ObjString *string = (ObjString *)allocateObject(vm, sizeof(ObjString) + (length + 1) * sizeof(char), OBJ_STRING);
     string->length = length;
     return string;
 }
 
-ObjString * UpdateHash(ObjString *str)
+// Returns the interned concatenation of the strings in parts, allocating
+// only if it is not interned yet.
+ObjString *concatenateStrings(VM *vm, Value *parts, int count)
 {
-    str->hash = hashString(str->chars, str->length);
-    ObjString *interned = tableFindString(&vm.strings, str->chars, str->length, str->hash);
+    ObjString *first = AS_STRING(parts[0]);
+    uint32_t hash = first->hash;
+    int length = first->length;
+    for (int i = 1; i < count; i++)
+    {
+        ObjString *part = AS_STRING(parts[i]);
+        hash = continueHash(hash, part->chars, part->length);
+        length += part->length;
+    }
+    ObjString *interned = tableFindConcatenation(&vm->strings, parts, count, length, hash);
     if (interned != NULL)
     {
         return interned;
     }
-    return str;
+
+    ObjString *result = emptyString(vm, length);
+    char *end = result->chars;
+    for (int i = 0; i < count; i++)
+    {
+        ObjString *part = AS_STRING(parts[i]);
+        memcpy(end, part->chars, part->length);
+        end += part->length;
+    }
+    result->chars[length] = '\0';
+    result->hash = hash;
+    tableSet(vm, &vm->strings, OBJ_VAL(result), NIL_VAL);
+    return result;
 }
 
-ObjString *copyString(const char *chars, int length)
+ObjString *copyString(VM *vm, const char *chars, int length)
 {
     uint32_t hash = hashString(chars, length);
-    ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString *interned = tableFindString(&vm->strings, chars, length, hash);
     if (interned != NULL)
     {
         return interned;
     }
-    return allocateString(chars, length, hash);
+    PROFILE_ORIGIN(vm, ALLOC_FROM_INTERN);
+    ObjString *string = allocateString(vm, chars, length, hash);
+    PROFILE_ORIGIN(vm, ALLOC_FROM_OTHER);
+    return string;
 }
 
-void printObject(Value value)
+const char *objectTypeName(ObjType type)
+{
+    switch (type)
+    {
+    case OBJ_FLOAT64_ARRAY:
+        return "float64 array";
+    case OBJ_FUNCTION:
+        return "function";
+    case OBJ_NATIVE:
+        return "native";
+    case OBJ_STRING:
+        return "string";
+    }
+    return "object";
+}
+
+void printObject(FILE *file, Value value)
 {
     switch (OBJ_TYPE(value))
     {
+    case OBJ_FLOAT64_ARRAY:
+        fprintf(file, "<Float64Array %d>", AS_FLOAT64_ARRAY(value)->length);
+        break;
+    case OBJ_FUNCTION:
+        fprintf(file, "<fn %s>", AS_FUNCTION(value)->name->chars);
+        break;
+    case OBJ_NATIVE:
+        fprintf(file, "<native fn %s>", AS_NATIVE(value)->name->chars);
+        break;
     case OBJ_STRING:
-        printf("%s", AS_CSTRING(value));
+        fputs(AS_CSTRING(value), file);
         break;
     }
 }
\ No newline at end of file
@@ -1,18 +1,28 @@
 #ifndef clox_object_h
 #define clox_object_h
 
+#include "chunk.h"
 #include "common.h"
 #include "value.h"
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
+#define IS_FLOAT64_ARRAY(value) isObjType(value, OBJ_FLOAT64_ARRAY)
+#define IS_FUNCTION(value) isObjType(value, OBJ_FUNCTION)
+#define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
 
+#define AS_FLOAT64_ARRAY(value) ((ObjFloat64Array *)AS_OBJ(value))
+#define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ(value))
+#define AS_NATIVE(value) ((ObjNative *)AS_OBJ(value))
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
 
 typedef enum
 {
+    OBJ_FLOAT64_ARRAY,
+    OBJ_FUNCTION,
+    OBJ_NATIVE,
     OBJ_STRING,
 } ObjType;
 
@@ -30,10 +40,52 @@ struct sObjString
     char chars[];
 };
 
-ObjString *emptyString(int length);
-ObjString *copyString(const char *chars, int length);
-ObjString *UpdateHash(ObjString *str);
-void printObject(Value value);
+// A function's chunk lives on the VM heap, so it outlives the arena of
+// the script that declared it.
+typedef struct
+{
+    Obj obj;
+    int arity;
+    Chunk chunk;
+    ObjString *name;
+} ObjFunction;
+
+// A native reads its arguments from args and stores its return value in
+// result. It returns false after reporting a runtime error.
+typedef bool (*NativeFn)(VM *vm, Value *args, Value *result);
+
+typedef struct
+{
+    Obj obj;
+    int arity;
+    NativeFn function;
+    ObjString *name;
+} ObjNative;
+
+// The elements follow the header in the same block, starting at the first
+// FLOAT64_ARRAY_ALIGNMENT boundary so that vector kernels can use aligned
+// loads and no element straddles a cache line.
+#define FLOAT64_ARRAY_ALIGNMENT 64
+#define FLOAT64_ARRAY_MAX (INT32_MAX / (int)sizeof(double))
+#define FLOAT64_ARRAY_SIZE(length) \
+    (sizeof(ObjFloat64Array) + FLOAT64_ARRAY_ALIGNMENT + (size_t)(length) * sizeof(double))
+
+typedef struct
+{
+    Obj obj;
+    int length;
+    double *values;
+} ObjFloat64Array;
+
+ObjFloat64Array *newFloat64Array(VM *vm, int length);
+ObjFunction *newFunction(VM *vm);
+ObjNative *newNative(VM *vm, ObjString *name, int arity, NativeFn function);
+uint32_t hashString(const char *key, int length);
+ObjString *emptyString(VM *vm, int length);
+ObjString *copyString(VM *vm, const char *chars, int length);
+ObjString *concatenateStrings(VM *vm, Value *parts, int count);
+void printObject(FILE *file, Value value);
+const char *objectTypeName(ObjType type);
 static inline bool isObjType(Value value, ObjType type)
 {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "object.h"
+#include "output.h"
+#include "vm.h"
+
+void initOutput(OutputBuffer *buffer)
+{
+    buffer->length = 0;
+}
+
+void flushOutput(VM *vm)
+{
+    OutputBuffer *buffer = &vm->buffer;
+    if (buffer->length > 0)
+    {
+        fwrite(buffer->data, 1, buffer->length, vm->output);
+        buffer->length = 0;
+    }
+    fflush(vm->output);
+}
+
+void writeOutput(VM *vm, const char *chars, size_t length)
+{
+    OutputBuffer *buffer = &vm->buffer;
+    if (length > OUTPUT_BUFFER_SIZE - buffer->length)
+    {
+        flushOutput(vm);
+        if (length > OUTPUT_BUFFER_SIZE)
+        {
+            fwrite(chars, 1, length, vm->output);
+            return;
+        }
+    }
+    memcpy(buffer->data + buffer->length, chars, length);
+    buffer->length += length;
+}
+
+// Writes the value and a newline, as OP_PRINT does.
+void printOutput(VM *vm, Value value)
+{
+    OutputBuffer *buffer = &vm->buffer;
+    if (IS_NUMERIC(value))
+    {
+        if (OUTPUT_BUFFER_SIZE - buffer->length < NUMBER_BUFFER_SIZE + 1)
+        {
+            flushOutput(vm);
+        }
+        // Integers print exactly as the equal double would.
+        buffer->length += formatNumber(AS_DOUBLE(value), buffer->data + buffer->length);
+        buffer->data[buffer->length++] = '\n';
+        return;
+    }
+
+    switch (value.type)
+    {
+    case VAL_BOOL:
+        if (AS_BOOL(value))
+        {
+            writeOutput(vm, "true\n", 5);
+        }
+        else
+        {
+            writeOutput(vm, "false\n", 6);
+        }
+        break;
+    case VAL_NIL:
+        writeOutput(vm, "nil\n", 4);
+        break;
+    case VAL_OBJ:
+    {
+        if (!IS_STRING(value))
+        {
+            flushOutput(vm);
+            printObject(vm->output, value);
+            fputc('\n', vm->output);
+            break;
+        }
+        ObjString *string = AS_STRING(value);
+        writeOutput(vm, string->chars, string->length);
+        writeOutput(vm, "\n", 1);
+        break;
+    }
+    case VAL_EMPTY:
+        writeOutput(vm, "[empty]\n", 8);
+        break;
+    case VAL_NUMBER:
+    case VAL_INT:
+        break;
+    }
+}
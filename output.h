@@ -0,0 +1,23 @@
+#ifndef clox_output_h
+#define clox_output_h
+
+#include "common.h"
+#include "value.h"
+
+// OP_PRINT formats into a buffer owned by the VM instead of going through
+// stdio for every value. The buffer is written to vm->output when it is
+// full, before a runtime error is reported and when a chunk finishes.
+#define OUTPUT_BUFFER_SIZE (16 * 1024)
+
+typedef struct
+{
+    size_t length;
+    char data[OUTPUT_BUFFER_SIZE];
+} OutputBuffer;
+
+void initOutput(OutputBuffer *buffer);
+void flushOutput(VM *vm);
+void writeOutput(VM *vm, const char *chars, size_t length);
+void printOutput(VM *vm, Value value);
+
+#endif
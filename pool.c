@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef POOL_HUGE_PAGES
+#include <sys/mman.h>
+#endif
+
+#include "pool.h"
+
+void initPool(Pool *pool)
+{
+    for (int i = 0; i < POOL_CLASS_COUNT; i++)
+    {
+        pool->freeLists[i] = NULL;
+        pool->next[i] = NULL;
+        pool->limit[i] = NULL;
+    }
+    pool->pageCursor = NULL;
+    pool->pageLimit = NULL;
+    pool->regions = NULL;
+}
+
+static PoolRegion *mapRegion(size_t size)
+{
+#ifdef POOL_HUGE_PAGES
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        // No reserved huge pages, ask for transparent ones instead.
+        memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            return NULL;
+        }
+        madvise(memory, size, MADV_HUGEPAGE);
+    }
+    PoolRegion *region = (PoolRegion *)memory;
+    region->mapped = true;
+#else
+    PoolRegion *region = (PoolRegion *)malloc(size);
+    if (region == NULL)
+    {
+        return NULL;
+    }
+    region->mapped = false;
+#endif
+    region->size = size;
+    return region;
+}
+
+static void unmapRegion(PoolRegion *region)
+{
+#ifdef POOL_HUGE_PAGES
+    if (region->mapped)
+    {
+        munmap(region, region->size);
+        return;
+    }
+#endif
+    free(region);
+}
+
+static bool newPage(Pool *pool, int sizeClass)
+{
+    if (pool->pageLimit - pool->pageCursor < POOL_PAGE_SIZE)
+    {
+        PoolRegion *region = mapRegion(POOL_REGION_SIZE);
+        if (region == NULL)
+        {
+            return false;
+        }
+        region->next = pool->regions;
+        pool->regions = region;
+
+        // The region header shares the first page with the slots.
+        size_t header = (sizeof(PoolRegion) + POOL_GRANULARITY - 1) & ~(size_t)(POOL_GRANULARITY - 1);
+        pool->pageCursor = (char *)region + header;
+        pool->pageLimit = (char *)region + region->size;
+    }
+
+    pool->next[sizeClass] = pool->pageCursor;
+    pool->pageCursor += POOL_PAGE_SIZE;
+    if (pool->pageCursor > pool->pageLimit)
+    {
+        pool->pageCursor = pool->pageLimit;
+    }
+    pool->limit[sizeClass] = pool->pageCursor;
+    return true;
+}
+
+void *poolAllocate(Pool *pool, size_t size)
+{
+    int sizeClass = poolClass(size);
+    PoolSlot *slot = pool->freeLists[sizeClass];
+    if (slot != NULL)
+    {
+        pool->freeLists[sizeClass] = slot->next;
+        return slot;
+    }
+
+    size_t slotSize = (size_t)(sizeClass + 1) * POOL_GRANULARITY;
+    if ((size_t)(pool->limit[sizeClass] - pool->next[sizeClass]) < slotSize)
+    {
+        if (!newPage(pool, sizeClass))
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(74);
+        }
+    }
+
+    void *result = pool->next[sizeClass];
+    pool->next[sizeClass] += slotSize;
+    return result;
+}
+
+void poolFree(Pool *pool, void *pointer, size_t size)
+{
+    int sizeClass = poolClass(size);
+    PoolSlot *slot = (PoolSlot *)pointer;
+    slot->next = pool->freeLists[sizeClass];
+    pool->freeLists[sizeClass] = slot;
+}
+
+void freePool(Pool *pool)
+{
+    PoolRegion *region = pool->regions;
+    while (region != NULL)
+    {
+        PoolRegion *next = region->next;
+        unmapRegion(region);
+        region = next;
+    }
+    initPool(pool);
+}
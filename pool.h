@@ -0,0 +1,57 @@
+#ifndef clox_pool_h
+#define clox_pool_h
+
+#include "common.h"
+
+// Blocks up to POOL_MAX_SIZE bytes are served from per-size-class free
+// lists. Each size class owns whole pages, which are carved out of larger
+// regions requested from the system.
+#define POOL_GRANULARITY 16
+#define POOL_MAX_SIZE 256
+#define POOL_CLASS_COUNT (POOL_MAX_SIZE / POOL_GRANULARITY)
+#define POOL_PAGE_SIZE (64 * 1024)
+
+#ifdef POOL_HUGE_PAGES
+#define POOL_REGION_SIZE (2 * 1024 * 1024)
+#else
+#define POOL_REGION_SIZE (8 * POOL_PAGE_SIZE)
+#endif
+
+typedef struct sPoolSlot
+{
+    struct sPoolSlot *next;
+} PoolSlot;
+
+typedef struct sPoolRegion
+{
+    struct sPoolRegion *next;
+    size_t size;
+    bool mapped;
+} PoolRegion;
+
+typedef struct
+{
+    PoolSlot *freeLists[POOL_CLASS_COUNT];
+    char *next[POOL_CLASS_COUNT];
+    char *limit[POOL_CLASS_COUNT];
+    char *pageCursor;
+    char *pageLimit;
+    PoolRegion *regions;
+} Pool;
+
+static inline bool poolHandles(size_t size)
+{
+    return size != 0 && size <= POOL_MAX_SIZE;
+}
+
+static inline int poolClass(size_t size)
+{
+    return (int)((size + POOL_GRANULARITY - 1) / POOL_GRANULARITY) - 1;
+}
+
+void initPool(Pool *pool);
+void freePool(Pool *pool);
+void *poolAllocate(Pool *pool, size_t size);
+void poolFree(Pool *pool, void *pointer, size_t size);
+
+#endif
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "profiler.h"
+
+#ifdef PROFILE_ALLOCATIONS
+
+void initAllocationProfiler(AllocationProfiler *profiler)
+{
+    profiler->phase = ALLOC_IN_INIT;
+    profiler->compileLine = 0;
+    profiler->chunk = NULL;
+    profiler->instruction = NULL;
+    profiler->origin = ALLOC_FROM_OTHER;
+    profiler->kind = NULL;
+    profiler->count = 0;
+    profiler->capacity = 0;
+    profiler->sites = NULL;
+}
+
+void freeAllocationProfiler(AllocationProfiler *profiler)
+{
+    // The site table is not allocated through reallocate() so that it
+    // does not show up in its own profile.
+    free(profiler->sites);
+    initAllocationProfiler(profiler);
+}
+
+void profileCompile(AllocationProfiler *profiler, Chunk *chunk)
+{
+    profiler->phase = ALLOC_IN_COMPILE;
+    profiler->chunk = chunk;
+    profiler->instruction = NULL;
+}
+
+void profileRun(AllocationProfiler *profiler, Chunk *chunk)
+{
+    profiler->phase = ALLOC_IN_RUN;
+    profiler->chunk = chunk;
+    profiler->instruction = chunk->code;
+}
+
+static bool sameSite(AllocSite *site, AllocSite *key)
+{
+    return site->phase == key->phase &&
+           site->opcode == key->opcode &&
+           site->line == key->line &&
+           site->origin == key->origin &&
+           site->kind == key->kind;
+}
+
+static uint32_t hashSite(AllocSite *key)
+{
+    uint32_t hash = 2166136261u;
+    uint32_t parts[] = {key->phase, (uint32_t)key->opcode, (uint32_t)key->line,
+                        key->origin, (uint32_t)(uintptr_t)key->kind};
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++)
+    {
+        hash ^= parts[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static AllocSite *findSite(AllocSite *sites, int capacity, AllocSite *key)
+{
+    uint32_t index = hashSite(key) % capacity;
+    for (;;)
+    {
+        AllocSite *site = &sites[index];
+        if (site->kind == NULL || sameSite(site, key))
+        {
+            return site;
+        }
+        index = (index + 1) % capacity;
+    }
+}
+
+static void growSites(AllocationProfiler *profiler)
+{
+    int capacity = profiler->capacity < 64 ? 64 : profiler->capacity * 2;
+    AllocSite *sites = (AllocSite *)calloc(capacity, sizeof(AllocSite));
+    if (sites == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(74);
+    }
+    for (int i = 0; i < profiler->capacity; i++)
+    {
+        AllocSite *site = &profiler->sites[i];
+        if (site->kind != NULL)
+        {
+            *findSite(sites, capacity, site) = *site;
+        }
+    }
+    free(profiler->sites);
+    profiler->sites = sites;
+    profiler->capacity = capacity;
+}
+
+void profileAllocation(AllocationProfiler *profiler, size_t size)
+{
+    AllocSite key;
+    key.phase = profiler->phase;
+    key.origin = profiler->origin;
+    key.kind = profiler->kind != NULL ? profiler->kind : "buffer";
+    if (key.phase == ALLOC_IN_RUN && profiler->instruction != NULL)
+    {
+        Chunk *chunk = profiler->chunk;
+        int offset = (int)(profiler->instruction - chunk->code);
+        key.opcode = *profiler->instruction;
+        key.line = getLine(chunk, offset);
+    }
+    else
+    {
+        key.opcode = -1;
+        key.line = profiler->compileLine;
+    }
+
+    if (profiler->count + 1 > profiler->capacity * 3 / 4)
+    {
+        growSites(profiler);
+    }
+    AllocSite *site = findSite(profiler->sites, profiler->capacity, &key);
+    if (site->kind == NULL)
+    {
+        *site = key;
+        site->bytes = 0;
+        site->count = 0;
+        profiler->count++;
+    }
+    site->bytes += size;
+    site->count++;
+}
+
+static int compareSites(const void *a, const void *b)
+{
+    const AllocSite *left = (const AllocSite *)a;
+    const AllocSite *right = (const AllocSite *)b;
+    if (left->bytes != right->bytes)
+    {
+        return left->bytes < right->bytes ? 1 : -1;
+    }
+    return left->count < right->count ? 1 : left->count > right->count ? -1 : 0;
+}
+
+static const char *originName(AllocOrigin origin)
+{
+    switch (origin)
+    {
+    case ALLOC_FROM_INTERN:
+        return "intern";
+    case ALLOC_FROM_CONCATENATE:
+        return "concatenate";
+    case ALLOC_FROM_OTHER:
+        break;
+    }
+    return "other";
+}
+
+// Writes one folded stack per site (phase;line;opcode;origin;kind bytes),
+// heaviest first, and a table with allocation counts to stderr. Init
+// sites have no line or opcode. The site table is sorted in place, so
+// only freeAllocationProfiler() may follow.
+void reportAllocations(AllocationProfiler *profiler, FILE *file)
+{
+    int count = 0;
+    for (int i = 0; i < profiler->capacity; i++)
+    {
+        if (profiler->sites[i].kind != NULL)
+        {
+            profiler->sites[count++] = profiler->sites[i];
+        }
+    }
+    qsort(profiler->sites, count, sizeof(AllocSite), compareSites);
+
+    fprintf(stderr, "== allocations ==\n");
+    fprintf(stderr, "%12s %10s  %s\n", "bytes", "count", "site");
+    for (int i = 0; i < count; i++)
+    {
+        AllocSite *site = &profiler->sites[i];
+        const char *origin = originName(site->origin);
+        switch (site->phase)
+        {
+        case ALLOC_IN_RUN:
+        {
+            const char *opcode = opcodeName(site->opcode);
+            fprintf(file, "run;line %d;%s;%s;%s %zu\n",
+                    site->line, opcode, origin, site->kind, site->bytes);
+            fprintf(stderr, "%12zu %10zu  run line %d %s %s %s\n",
+                    site->bytes, site->count, site->line, opcode, origin, site->kind);
+            break;
+        }
+        case ALLOC_IN_COMPILE:
+            fprintf(file, "compile;line %d;%s;%s %zu\n",
+                    site->line, origin, site->kind, site->bytes);
+            fprintf(stderr, "%12zu %10zu  compile line %d %s %s\n",
+                    site->bytes, site->count, site->line, origin, site->kind);
+            break;
+        case ALLOC_IN_INIT:
+            // Made by initVM(), the natives and their names, before
+            // there is any source to point at.
+            fprintf(file, "init;%s;%s %zu\n", origin, site->kind, site->bytes);
+            fprintf(stderr, "%12zu %10zu  init %s %s\n",
+                    site->bytes, site->count, origin, site->kind);
+            break;
+        }
+    }
+}
+
+#endif
+
+#ifdef PROFILE_OPCODES
+
+void initOpcodeProfiler(OpcodeProfiler *profiler)
+{
+    memset(profiler, 0, sizeof(OpcodeProfiler));
+    profileChunkStart(profiler);
+}
+
+// A new chunk starts a new dispatch sequence, so the last opcode of the
+// previous run neither pairs with nor gets timed against the first one.
+void profileChunkStart(OpcodeProfiler *profiler)
+{
+    profiler->previous = -1;
+#ifdef PROFILE_OPCODE_CYCLES
+    profiler->countdown = PROFILE_CYCLE_INTERVAL;
+    profiler->timing = -1;
+#endif
+}
+
+uint64_t opcodeCount(OpcodeProfiler *profiler, int opcode)
+{
+    return profiler->counts[opcode];
+}
+
+uint64_t opcodePairCount(OpcodeProfiler *profiler, int first, int second)
+{
+    return profiler->pairs[first][second];
+}
+
+// Estimated total for the opcode: the sampled mean times its count. Zero
+// without -DPROFILE_OPCODE_CYCLES.
+uint64_t opcodeCycles(OpcodeProfiler *profiler, int opcode)
+{
+#ifdef PROFILE_OPCODE_CYCLES
+    if (profiler->samples[opcode] == 0)
+    {
+        return 0;
+    }
+    double mean = (double)profiler->cycles[opcode] / (double)profiler->samples[opcode];
+    return (uint64_t)(mean * (double)profiler->counts[opcode]);
+#else
+    (void)profiler;
+    (void)opcode;
+    return 0;
+#endif
+}
+
+typedef struct
+{
+    int first;
+    int second;
+    uint64_t count;
+} OpcodeRow;
+
+static int compareRows(const void *a, const void *b)
+{
+    const OpcodeRow *left = (const OpcodeRow *)a;
+    const OpcodeRow *right = (const OpcodeRow *)b;
+    return left->count < right->count ? 1 : left->count > right->count ? -1 : 0;
+}
+
+#ifdef PROFILE_OPCODE_CYCLES
+// Upper bound of the histogram bucket holding the given fraction of samples.
+static uint64_t percentile(uint64_t *histogram, uint64_t samples, double fraction)
+{
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < PROFILE_CYCLE_BUCKETS; bucket++)
+    {
+        seen += histogram[bucket];
+        if ((double)seen >= fraction * (double)samples)
+        {
+            return (uint64_t)1 << bucket;
+        }
+    }
+    return (uint64_t)1 << (PROFILE_CYCLE_BUCKETS - 1);
+}
+#endif
+
+#define PAIRS_REPORTED 16
+
+// Prints the opcodes sorted by dispatch count (by estimated cycles when
+// timing) followed by the most frequent dispatch pairs.
+void reportOpcodes(OpcodeProfiler *profiler, FILE *file)
+{
+    OpcodeRow rows[OPCODE_COUNT];
+    uint64_t total = 0;
+    uint64_t totalCycles = 0;
+    for (int i = 0; i < OPCODE_COUNT; i++)
+    {
+        rows[i].first = i;
+        rows[i].second = -1;
+#ifdef PROFILE_OPCODE_CYCLES
+        rows[i].count = opcodeCycles(profiler, i);
+#else
+        rows[i].count = profiler->counts[i];
+#endif
+        total += profiler->counts[i];
+        totalCycles += opcodeCycles(profiler, i);
+    }
+    qsort(rows, OPCODE_COUNT, sizeof(OpcodeRow), compareRows);
+
+    fprintf(file, "== opcodes ==\n");
+#ifdef PROFILE_OPCODE_CYCLES
+    fprintf(file, "%-22s %14s %7s %10s %8s %8s %7s\n",
+            "opcode", "count", "count%", "mean", "p50<", "p99<", "time%");
+#else
+    fprintf(file, "%-22s %14s %7s\n", "opcode", "count", "count%");
+#endif
+    for (int i = 0; i < OPCODE_COUNT; i++)
+    {
+        int opcode = rows[i].first;
+        uint64_t count = profiler->counts[opcode];
+        if (count == 0)
+        {
+            continue;
+        }
+        fprintf(file, "%-22s %14llu %6.2f%%", opcodeName(opcode),
+                (unsigned long long)count, 100.0 * (double)count / (double)total);
+#ifdef PROFILE_OPCODE_CYCLES
+        uint64_t samples = profiler->samples[opcode];
+        if (samples > 0)
+        {
+            uint64_t *histogram = profiler->histogram[opcode];
+            fprintf(file, " %10.1f %8llu %8llu %6.2f%%",
+                    (double)profiler->cycles[opcode] / (double)samples,
+                    (unsigned long long)percentile(histogram, samples, 0.5),
+                    (unsigned long long)percentile(histogram, samples, 0.99),
+                    100.0 * (double)rows[i].count / (double)totalCycles);
+        }
+#endif
+        fputc('\n', file);
+    }
+
+    OpcodeRow pairs[PAIRS_REPORTED];
+    int count = 0;
+    for (int first = 0; first < OPCODE_COUNT; first++)
+    {
+        for (int second = 0; second < OPCODE_COUNT; second++)
+        {
+            OpcodeRow row = {first, second, profiler->pairs[first][second]};
+            if (row.count == 0)
+            {
+                continue;
+            }
+            if (count < PAIRS_REPORTED)
+            {
+                pairs[count++] = row;
+            }
+            else if (row.count > pairs[count - 1].count)
+            {
+                pairs[count - 1] = row;
+            }
+            else
+            {
+                continue;
+            }
+            qsort(pairs, count, sizeof(OpcodeRow), compareRows);
+        }
+    }
+
+    fprintf(file, "== dispatch pairs ==\n");
+    fprintf(file, "%-22s %-22s %14s\n", "first", "second", "count");
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(file, "%-22s %-22s %14llu\n", opcodeName(pairs[i].first),
+                opcodeName(pairs[i].second), (unsigned long long)pairs[i].count);
+    }
+}
+
+#undef PAIRS_REPORTED
+
+#endif
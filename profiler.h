@@ -0,0 +1,188 @@
+#ifndef clox_profiler_h
+#define clox_profiler_h
+
+#include <stdio.h>
+#ifdef PROFILE_OPCODE_CYCLES
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+#include "common.h"
+#include "chunk.h"
+
+// Allocation-site profiling is compiled in with -DPROFILE_ALLOCATIONS.
+// Every allocation made through reallocate() is attributed to the phase
+// (init until the first compile, then compile or run), the source line,
+// the executing opcode, the origin and the kind of memory requested. The
+// sites are written sorted by bytes in folded-stack format when the VM is
+// freed. Each VM profiles its own heap.
+
+#define ALLOCATION_PROFILE_FILE "allocations.folded"
+
+typedef enum
+{
+    ALLOC_IN_INIT,
+    ALLOC_IN_COMPILE,
+    ALLOC_IN_RUN,
+} AllocPhase;
+
+typedef enum
+{
+    ALLOC_FROM_OTHER,
+    ALLOC_FROM_INTERN,
+    ALLOC_FROM_CONCATENATE,
+} AllocOrigin;
+
+typedef struct
+{
+    AllocPhase phase;
+    int opcode;
+    int line;
+    AllocOrigin origin;
+    const char *kind;
+    size_t bytes;
+    size_t count;
+} AllocSite;
+
+typedef struct
+{
+    AllocPhase phase;
+    int compileLine;
+    Chunk *chunk;
+    uint8_t *instruction;
+    AllocOrigin origin;
+    const char *kind;
+
+    int count;
+    int capacity;
+    AllocSite *sites;
+} AllocationProfiler;
+
+#ifdef PROFILE_ALLOCATIONS
+
+#define PROFILE_COMPILE_LINE(vm, line) ((vm)->allocations.compileLine = (line))
+#define PROFILE_INSTRUCTION(vm, code, ip) \
+    ((vm)->allocations.chunk = (code), (vm)->allocations.instruction = (ip))
+#define PROFILE_ORIGIN(vm, from) ((vm)->allocations.origin = (from))
+#define PROFILE_KIND(vm, name) ((vm)->allocations.kind = (name))
+
+void initAllocationProfiler(AllocationProfiler *profiler);
+void freeAllocationProfiler(AllocationProfiler *profiler);
+void profileCompile(AllocationProfiler *profiler, Chunk *chunk);
+void profileRun(AllocationProfiler *profiler, Chunk *chunk);
+void profileAllocation(AllocationProfiler *profiler, size_t size);
+void reportAllocations(AllocationProfiler *profiler, FILE *file);
+
+#else
+
+#define PROFILE_COMPILE_LINE(vm, line) ((void)0)
+#define PROFILE_INSTRUCTION(vm, code, ip) ((void)0)
+#define PROFILE_ORIGIN(vm, from) ((void)0)
+#define PROFILE_KIND(vm, name) ((void)0)
+
+#endif
+
+// Opcode profiling is compiled in with -DPROFILE_OPCODES. It counts how
+// often each opcode and each pair of consecutive opcodes is dispatched.
+// Adding -DPROFILE_OPCODE_CYCLES also times one dispatch in every
+// PROFILE_CYCLE_INTERVAL with the cycle counter and keeps a log2 histogram
+// of the samples per opcode. A sorted table is printed when the VM is
+// freed; embedders can read the counters before that.
+
+#ifdef PROFILE_OPCODES
+
+#ifndef PROFILE_CYCLE_INTERVAL
+#define PROFILE_CYCLE_INTERVAL 16
+#endif
+#define PROFILE_CYCLE_BUCKETS 32
+
+typedef struct
+{
+    int previous;
+    uint64_t counts[OPCODE_COUNT];
+    uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT];
+#ifdef PROFILE_OPCODE_CYCLES
+    int countdown;
+    int timing;
+    uint64_t started;
+    uint64_t samples[OPCODE_COUNT];
+    uint64_t cycles[OPCODE_COUNT];
+    uint64_t histogram[OPCODE_COUNT][PROFILE_CYCLE_BUCKETS];
+#endif
+} OpcodeProfiler;
+
+#ifdef PROFILE_OPCODE_CYCLES
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t readCycles()
+{
+    return __rdtsc();
+}
+#else
+// No cycle counter available, nanoseconds stand in for cycles.
+static inline uint64_t readCycles()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+#endif
+
+static inline void recordCycles(OpcodeProfiler *profiler, uint64_t cycles)
+{
+    int opcode = profiler->timing;
+    int bucket = cycles == 0 ? 0 : 64 - __builtin_clzll(cycles);
+    if (bucket >= PROFILE_CYCLE_BUCKETS)
+    {
+        bucket = PROFILE_CYCLE_BUCKETS - 1;
+    }
+    profiler->samples[opcode]++;
+    profiler->cycles[opcode] += cycles;
+    profiler->histogram[opcode][bucket]++;
+    profiler->timing = -1;
+}
+#endif
+
+// Called once per dispatch, before the opcode executes.
+static inline void profileOpcode(OpcodeProfiler *profiler, uint8_t opcode)
+{
+#ifdef PROFILE_OPCODE_CYCLES
+    if (profiler->timing >= 0)
+    {
+        recordCycles(profiler, readCycles() - profiler->started);
+    }
+#endif
+    profiler->counts[opcode]++;
+    if (profiler->previous >= 0)
+    {
+        profiler->pairs[profiler->previous][opcode]++;
+    }
+    profiler->previous = opcode;
+#ifdef PROFILE_OPCODE_CYCLES
+    if (--profiler->countdown == 0)
+    {
+        profiler->countdown = PROFILE_CYCLE_INTERVAL;
+        profiler->timing = opcode;
+        profiler->started = readCycles();
+    }
+#endif
+}
+
+#define PROFILE_OPCODE(vm, opcode) profileOpcode(&(vm)->opcodes, (opcode))
+
+void initOpcodeProfiler(OpcodeProfiler *profiler);
+void profileChunkStart(OpcodeProfiler *profiler);
+uint64_t opcodeCount(OpcodeProfiler *profiler, int opcode);
+uint64_t opcodePairCount(OpcodeProfiler *profiler, int first, int second);
+uint64_t opcodeCycles(OpcodeProfiler *profiler, int opcode);
+void reportOpcodes(OpcodeProfiler *profiler, FILE *file);
+
+#else
+
+#define PROFILE_OPCODE(vm, opcode) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,319 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "debug.h"
+#include "object.h"
+#include "sampler.h"
+#include "vm.h"
+
+#ifdef PROFILE_SAMPLES
+
+static SampleProfiler *sampling = NULL;
+
+static SampledChunk *findChunk(SampledChunk *chunks, int capacity, Chunk *chunk)
+{
+    uint32_t index = (uint32_t)((uintptr_t)chunk >> 4) & (capacity - 1);
+    for (;;)
+    {
+        SampledChunk *entry = &chunks[index];
+        if (entry->chunk == chunk || entry->chunk == NULL)
+        {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+// Runs on the interrupted thread, so it only reads and bumps counters.
+// The chunk table is filled in before running is set and only changed
+// after it is cleared, which is all the handler relies on. vm->chunk and
+// vm->ip may be caught in between two calls; the bounds check keeps such
+// a sample inside the counters.
+static void takeSample(int signal)
+{
+    (void)signal;
+    SampleProfiler *profiler = __atomic_load_n(&sampling, __ATOMIC_ACQUIRE);
+    if (profiler == NULL)
+    {
+        return;
+    }
+    if (!__atomic_load_n(&profiler->running, __ATOMIC_ACQUIRE))
+    {
+        __atomic_fetch_add(&profiler->outside, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    Chunk *chunk = profiler->vm->chunk;
+    SampledChunk *entry = findChunk(profiler->chunks, profiler->chunkCapacity, chunk);
+    ptrdiff_t offset = entry->chunk == NULL ? -1 : profiler->vm->ip - chunk->code;
+    if (offset >= 0 && offset < entry->count)
+    {
+        __atomic_fetch_add(&entry->offsets[offset], 1, __ATOMIC_RELAXED);
+        entry->hit = true;
+    }
+    else
+    {
+        __atomic_fetch_add(&profiler->unknown, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static bool setTimer(int hz)
+{
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz > 0 ? 1000000 / hz : 0;
+    timer.it_value = timer.it_interval;
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+bool startSampling(SampleProfiler *profiler, VM *vm, int hz)
+{
+    memset(profiler, 0, sizeof(SampleProfiler));
+    profiler->vm = vm;
+    profiler->hz = hz;
+    if (hz <= 0 || hz > 1000000)
+    {
+        return false;
+    }
+
+    SampleProfiler *expected = NULL;
+    if (!__atomic_compare_exchange_n(&sampling, &expected, profiler, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = takeSample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0 || !setTimer(hz))
+    {
+        __atomic_store_n(&sampling, NULL, __ATOMIC_RELEASE);
+        return false;
+    }
+    return true;
+}
+
+void stopSampling(SampleProfiler *profiler)
+{
+    if (__atomic_load_n(&sampling, __ATOMIC_ACQUIRE) != profiler)
+    {
+        return;
+    }
+    setTimer(0);
+    __atomic_store_n(&sampling, NULL, __ATOMIC_RELEASE);
+}
+
+static bool growChunks(SampleProfiler *profiler)
+{
+    int capacity = profiler->chunkCapacity < 64 ? 64 : profiler->chunkCapacity * 2;
+    SampledChunk *chunks = (SampledChunk *)calloc(capacity, sizeof(SampledChunk));
+    if (chunks == NULL)
+    {
+        return false;
+    }
+    for (int i = 0; i < profiler->chunkCapacity; i++)
+    {
+        SampledChunk *entry = &profiler->chunks[i];
+        if (entry->chunk != NULL)
+        {
+            *findChunk(chunks, capacity, entry->chunk) = *entry;
+        }
+    }
+    free(profiler->chunks);
+    profiler->chunks = chunks;
+    profiler->chunkCapacity = capacity;
+    return true;
+}
+
+// Adds the chunk and the functions it declares to the table. A script
+// chunk may reuse the address of one that has been freed, so an entry
+// whose size no longer matches starts over.
+static void addChunk(SampleProfiler *profiler, Chunk *chunk, const char *name)
+{
+    if (profiler->chunkCount + 1 > profiler->chunkCapacity * 3 / 4 && !growChunks(profiler))
+    {
+        return;
+    }
+    SampledChunk *entry = findChunk(profiler->chunks, profiler->chunkCapacity, chunk);
+    if (entry->chunk == NULL)
+    {
+        profiler->chunkCount++;
+    }
+    entry->name = name;
+    if (entry->chunk != chunk || entry->count != chunk->count)
+    {
+        free(entry->offsets);
+        entry->chunk = chunk;
+        entry->count = chunk->count;
+        entry->offsets = (uint32_t *)calloc(chunk->count > 0 ? chunk->count : 1, sizeof(uint32_t));
+        entry->hit = false;
+        if (entry->offsets == NULL)
+        {
+            entry->count = 0;
+        }
+    }
+
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        if (IS_FUNCTION(chunk->constants.values[i]))
+        {
+            ObjFunction *function = AS_FUNCTION(chunk->constants.values[i]);
+            addChunk(profiler, &function->chunk,
+                     function->name != NULL ? function->name->chars : "function");
+        }
+    }
+}
+
+void sampleChunkStart(SampleProfiler *profiler, Chunk *chunk)
+{
+    if (__atomic_load_n(&sampling, __ATOMIC_ACQUIRE) != profiler)
+    {
+        return;
+    }
+    addChunk(profiler, chunk, "script");
+    if (profiler->chunkCapacity > 0)
+    {
+        __atomic_store_n(&profiler->running, true, __ATOMIC_RELEASE);
+    }
+}
+
+static void addLine(SampleProfiler *profiler, const char *name, int line, uint64_t count)
+{
+    if (line < 0)
+    {
+        return;
+    }
+    for (int i = 0; i < profiler->lineCount; i++)
+    {
+        SampledLine *row = &profiler->lines[i];
+        if (row->line == line && strcmp(row->name, name) == 0)
+        {
+            row->count += count;
+            profiler->total += count;
+            return;
+        }
+    }
+    if (profiler->lineCount + 1 > profiler->lineCapacity)
+    {
+        int capacity = profiler->lineCapacity < 64 ? 64 : profiler->lineCapacity * 2;
+        SampledLine *lines = (SampledLine *)realloc(profiler->lines, capacity * sizeof(SampledLine));
+        if (lines == NULL)
+        {
+            return;
+        }
+        profiler->lines = lines;
+        profiler->lineCapacity = capacity;
+    }
+    // Function names are freed with the VM, before the report is written.
+    char *copy = strdup(name);
+    if (copy == NULL)
+    {
+        return;
+    }
+    SampledLine *row = &profiler->lines[profiler->lineCount++];
+    row->name = copy;
+    row->line = line;
+    row->count = count;
+    profiler->total += count;
+}
+
+// Folds the offsets sampled while the chunk ran, in it and in every
+// function it called, into source lines and clears them. Must be called
+// before the chunk is freed.
+void sampleChunkEnd(SampleProfiler *profiler)
+{
+    if (!profiler->running)
+    {
+        return;
+    }
+    __atomic_store_n(&profiler->running, false, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < profiler->chunkCapacity; i++)
+    {
+        SampledChunk *entry = &profiler->chunks[i];
+        if (entry->chunk == NULL || !entry->hit)
+        {
+            continue;
+        }
+        for (int offset = 0; offset < entry->count; offset++)
+        {
+            uint32_t count = __atomic_load_n(&entry->offsets[offset], __ATOMIC_RELAXED);
+            if (count > 0)
+            {
+                addLine(profiler, entry->name, getLine(entry->chunk, offset), count);
+                entry->offsets[offset] = 0;
+            }
+        }
+        entry->hit = false;
+    }
+}
+
+static int compareLines(const void *a, const void *b)
+{
+    const SampledLine *left = (const SampledLine *)a;
+    const SampledLine *right = (const SampledLine *)b;
+    return left->count < right->count ? 1 : left->count > right->count ? -1 : 0;
+}
+
+// Writes one folded stack per sampled line, hottest first, and the ten
+// hottest lines to stderr. The line table is sorted in place.
+void reportSamples(SampleProfiler *profiler, FILE *file)
+{
+    uint64_t outside = __atomic_load_n(&profiler->outside, __ATOMIC_RELAXED);
+    uint64_t unknown = __atomic_load_n(&profiler->unknown, __ATOMIC_RELAXED);
+    if (profiler->lineCount > 0)
+    {
+        qsort(profiler->lines, profiler->lineCount, sizeof(SampledLine), compareLines);
+    }
+    for (int i = 0; i < profiler->lineCount; i++)
+    {
+        SampledLine *row = &profiler->lines[i];
+        fprintf(file, "%s;line %d %llu\n", row->name, row->line, (unsigned long long)row->count);
+    }
+    if (outside > 0)
+    {
+        fprintf(file, "outside run %llu\n", (unsigned long long)outside);
+    }
+
+    fprintf(stderr, "== samples ==\n");
+    fprintf(stderr, "%llu samples at %d Hz, %llu outside run(), %llu not attributed\n",
+            (unsigned long long)(profiler->total + outside + unknown), profiler->hz,
+            (unsigned long long)outside, (unsigned long long)unknown);
+    for (int i = 0; i < profiler->lineCount && i < 10; i++)
+    {
+        SampledLine *row = &profiler->lines[i];
+        fprintf(stderr, "%12llu %6.2f%%  %s line %d\n", (unsigned long long)row->count,
+                100.0 * (double)row->count / (double)profiler->total, row->name, row->line);
+    }
+}
+
+void freeSampleProfiler(SampleProfiler *profiler)
+{
+    stopSampling(profiler);
+    // The VM's chunks may be gone by now, so a chunk still running is
+    // dropped rather than folded.
+    __atomic_store_n(&profiler->running, false, __ATOMIC_RELEASE);
+    for (int i = 0; i < profiler->chunkCapacity; i++)
+    {
+        free(profiler->chunks[i].offsets);
+    }
+    free(profiler->chunks);
+    profiler->chunks = NULL;
+    profiler->chunkCount = 0;
+    profiler->chunkCapacity = 0;
+    for (int i = 0; i < profiler->lineCount; i++)
+    {
+        free(profiler->lines[i].name);
+    }
+    free(profiler->lines);
+    profiler->lines = NULL;
+    profiler->lineCount = 0;
+    profiler->lineCapacity = 0;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef clox_sampler_h
+#define clox_sampler_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "chunk.h"
+
+// Sampling profiling is compiled in with -DPROFILE_SAMPLES. A SIGPROF
+// timer interrupts the process PROFILE_SAMPLE_HZ times per second of CPU
+// time and the handler bumps a counter for the chunk vm->chunk names and
+// the bytecode offset vm->ip is at, so time spent in functions counts too.
+// When a chunk finishes, the counters are folded into lines of the script
+// or function they belong to, which are written in folded-stack format
+// when the VM is freed. The timer is process wide, so only one VM samples
+// at a time.
+
+#define SAMPLE_PROFILE_FILE "samples.folded"
+
+#ifndef PROFILE_SAMPLE_HZ
+#define PROFILE_SAMPLE_HZ 997
+#endif
+
+typedef struct
+{
+    Chunk *chunk;
+    const char *name; // The function's, or "script".
+    int count;
+    uint32_t *offsets;
+    bool hit;
+} SampledChunk;
+
+typedef struct
+{
+    char *name;
+    int line;
+    uint64_t count;
+} SampledLine;
+
+typedef struct
+{
+    VM *vm;
+    int hz;
+
+    // The chunks the handler attributes samples to, hashed by address.
+    // Only changed while running is false.
+    int chunkCount;
+    int chunkCapacity;
+    SampledChunk *chunks;
+    bool running;
+
+    // Samples taken outside run(), e.g. while compiling, and in chunks the
+    // table does not know.
+    uint64_t outside;
+    uint64_t unknown;
+    uint64_t total;
+    int lineCount;
+    int lineCapacity;
+    SampledLine *lines;
+} SampleProfiler;
+
+#ifdef PROFILE_SAMPLES
+
+bool startSampling(SampleProfiler *profiler, VM *vm, int hz);
+void stopSampling(SampleProfiler *profiler);
+void sampleChunkStart(SampleProfiler *profiler, Chunk *chunk);
+void sampleChunkEnd(SampleProfiler *profiler);
+void reportSamples(SampleProfiler *profiler, FILE *file);
+void freeSampleProfiler(SampleProfiler *profiler);
+
+#endif
+
+#endif
@@ -1,103 +1,422 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "common.h"
 #include "scanner.h"
 
-typedef struct
+#if defined(__SSE2__) && !defined(SCANNER_SCALAR)
+#define SCANNER_SIMD
+#ifdef __AVX2__
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+#endif
+
+void initScanner(Scanner *scanner, const char *source, size_t length)
 {
-    const char *start;
-    const char *current;
-    int line;
-} Scanner;
+    scanner->source = source;
+    scanner->end = source + length;
+    scanner->start = source;
+    scanner->current = source;
+    scanner->line = 1;
+    scanner->block.base = NULL;
+    scanner->stream = NULL;
+    scanner->buffers[0] = NULL;
+    scanner->buffers[1] = NULL;
+    scanner->capacities[0] = 0;
+    scanner->capacities[1] = 0;
+    scanner->window = 0;
+    scanner->tokenWindow = 0;
+    scanner->length = length;
+}
 
-Scanner scanner;
+// The window starts out empty, the first look at it reads the stream.
+void initStreamScanner(Scanner *scanner, FILE *stream)
+{
+    initScanner(scanner, "", 0);
+    scanner->stream = stream;
+}
 
-void initScanner(const char *source)
+void freeScanner(Scanner *scanner)
 {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+    free(scanner->buffers[0]);
+    free(scanner->buffers[1]);
+    scanner->buffers[0] = NULL;
+    scanner->buffers[1] = NULL;
 }
 
-static bool isAtEnd()
+static void growBuffer(Scanner *scanner, int buffer, size_t size)
 {
-    return *scanner.current == '\0';
+    if (scanner->capacities[buffer] >= size)
+    {
+        return;
+    }
+    size_t capacity = scanner->capacities[buffer] * 2;
+    capacity = capacity < size ? size : capacity;
+    char *grown = (char *)realloc(scanner->buffers[buffer], capacity);
+    if (grown == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(74);
+    }
+    scanner->buffers[buffer] = grown;
+    scanner->capacities[buffer] = capacity;
 }
 
-static Token makeToken(TokenType type)
+// Moves the token being scanned to the front of a buffer the last token
+// returned is not in and reads more of the stream after it. Returns false
+// at the end of the input.
+static bool refill(Scanner *scanner)
+{
+    if (scanner->stream == NULL)
+    {
+        return false;
+    }
+
+    size_t kept = (size_t)(scanner->end - scanner->start);
+    size_t scanned = (size_t)(scanner->current - scanner->start);
+    int target = scanner->window;
+    if (target == scanner->tokenWindow)
+    {
+        target = 1 - target;
+        growBuffer(scanner, target, kept + SCAN_STREAM_SIZE);
+        memcpy(scanner->buffers[target], scanner->start, kept);
+    }
+    else
+    {
+        memmove(scanner->buffers[target], scanner->start, kept);
+        growBuffer(scanner, target, kept + SCAN_STREAM_SIZE);
+    }
+
+    char *buffer = scanner->buffers[target];
+    size_t read = fread(buffer + kept, 1, scanner->capacities[target] - kept, scanner->stream);
+    if (read == 0)
+    {
+        scanner->stream = NULL;
+    }
+    scanner->length += read;
+    scanner->window = target;
+    scanner->source = buffer;
+    scanner->end = buffer + kept + read;
+    scanner->start = buffer;
+    scanner->current = buffer + scanned;
+    scanner->block.base = NULL;
+    return read > 0;
+}
+
+static bool isAtEnd(Scanner *scanner)
+{
+    return scanner->current == scanner->end && !refill(scanner);
+}
+
+static Token makeToken(Scanner *scanner, TokenType type)
 {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
 
     return token;
 }
 
-static Token errorToken(const char *message)
+static Token errorToken(Scanner *scanner, const char *message)
 {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (int)strlen(message);
-    token.line = scanner.line;
+    token.line = scanner->line;
 
     return token;
 }
 
-static char advance()
+static char advance(Scanner *scanner)
 {
-    scanner.current++;
-    return scanner.current[-1];
+    scanner->current++;
+    return scanner->current[-1];
 }
 
-static bool match(char expected)
+static bool match(Scanner *scanner, char expected)
 {
-    if (isAtEnd())
+    if (isAtEnd(scanner))
         return false;
-    if (*scanner.current != expected)
+    if (*scanner->current != expected)
         return false;
 
-    scanner.current++;
+    scanner->current++;
     return true;
 }
 
-static char peek()
+static char peek(Scanner *scanner)
 {
-    return *scanner.current;
+    if (isAtEnd(scanner))
+        return '\0';
+    return *scanner->current;
 }
 
-static char peekNext()
+static char peekNext(Scanner *scanner)
 {
-    if (isAtEnd())
-        return '\0';
-    return scanner.current[1];
+    while (scanner->end - scanner->current < 2)
+    {
+        if (!refill(scanner))
+            return '\0';
+    }
+    return scanner->current[1];
+}
+
+#ifdef SCANNER_SIMD
+
+#ifdef __AVX2__
+#define VECTOR __m256i
+#define SPLAT(c) _mm256_set1_epi8(c)
+#define EQ(a, b) _mm256_cmpeq_epi8(a, b)
+#define GT(a, b) _mm256_cmpgt_epi8(a, b)
+#define OR(a, b) _mm256_or_si256(a, b)
+#define AND(a, b) _mm256_and_si256(a, b)
+#define ANDNOT(a, b) _mm256_andnot_si256(a, b)
+#define LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define MASK(v) ((uint64_t)(uint32_t)_mm256_movemask_epi8(v))
+#else
+#define VECTOR __m128i
+#define SPLAT(c) _mm_set1_epi8(c)
+#define EQ(a, b) _mm_cmpeq_epi8(a, b)
+#define GT(a, b) _mm_cmpgt_epi8(a, b)
+#define OR(a, b) _mm_or_si128(a, b)
+#define AND(a, b) _mm_and_si128(a, b)
+#define ANDNOT(a, b) _mm_andnot_si128(a, b)
+#define LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define MASK(v) ((uint64_t)(uint16_t)_mm_movemask_epi8(v))
+#endif
+
+static VECTOR isBlankVector(VECTOR c)
+{
+    return OR(OR(EQ(c, SPLAT(' ')), EQ(c, SPLAT('\t'))), EQ(c, SPLAT('\r')));
+}
+
+static VECTOR isNewlineVector(VECTOR c)
+{
+    return EQ(c, SPLAT('\n'));
+}
+
+static VECTOR isQuoteVector(VECTOR c)
+{
+    return EQ(c, SPLAT('"'));
+}
+
+static VECTOR inRange(VECTOR c, char low, char high)
+{
+    // Bytes above 0x7f compare as negative and fall below every range.
+    return ANDNOT(OR(GT(SPLAT(low), c), GT(c, SPLAT(high))), SPLAT(-1));
+}
+
+static VECTOR isIdentifierVector(VECTOR c)
+{
+    VECTOR letter = inRange(OR(c, SPLAT(0x20)), 'a', 'z');
+    VECTOR digit = inRange(c, '0', '9');
+    return OR(OR(letter, digit), EQ(c, SPLAT('_')));
+}
+
+// Stage one: classify a whole block of source at once. The block at the
+// end of the window is copied into a NUL-padded buffer first, so loads
+// never read past it.
+static ScanBlock *loadBlock(Scanner *scanner, const char *at)
+{
+    const char *base = scanner->source +
+                       (at - scanner->source) / SCAN_BLOCK_SIZE * SCAN_BLOCK_SIZE;
+    ScanBlock *block = &scanner->block;
+    if (block->base == base)
+    {
+        return block;
+    }
+
+    char padded[SCAN_BLOCK_SIZE];
+    const char *bytes = base;
+    if (scanner->end - base < SCAN_BLOCK_SIZE)
+    {
+        memset(padded, 0, SCAN_BLOCK_SIZE);
+        memcpy(padded, base, scanner->end - base);
+        bytes = padded;
+    }
+
+    block->base = base;
+    block->blank = 0;
+    block->newline = 0;
+    block->quote = 0;
+    block->identifier = 0;
+    for (int i = 0; i < SCAN_BLOCK_SIZE; i += (int)sizeof(VECTOR))
+    {
+        VECTOR c = LOAD(bytes + i);
+        block->blank |= MASK(isBlankVector(c)) << i;
+        block->newline |= MASK(isNewlineVector(c)) << i;
+        block->quote |= MASK(isQuoteVector(c)) << i;
+        block->identifier |= MASK(isIdentifierVector(c)) << i;
+    }
+    return block;
+}
+
+// Moves current to stop, which the block masks found to be the first
+// byte leaving a class. Returns false when that byte is the padding past
+// the window, where a refill may continue the class.
+static bool stopAt(Scanner *scanner, const char *stop)
+{
+    if (stop < scanner->end)
+    {
+        scanner->current = stop;
+        return true;
+    }
+    scanner->current = scanner->end;
+    return false;
+}
+
+// Stage two: the scanner jumps between class boundaries with bit scans.
+// Each helper moves current to the first byte that leaves the class, or
+// to the end of the input. Blanks and comments belong to no token, so
+// their helpers let a refill drop what they skipped.
+static void skipBlank(Scanner *scanner)
+{
+    for (;;)
+    {
+        scanner->start = scanner->current;
+        if (isAtEnd(scanner))
+        {
+            return;
+        }
+        ScanBlock *block = loadBlock(scanner, scanner->current);
+        int offset = (int)(scanner->current - block->base);
+        uint64_t other = ~(block->blank | block->newline) >> offset;
+        uint64_t newlines = block->newline >> offset;
+        if (other != 0)
+        {
+            int skipped = __builtin_ctzll(other);
+            newlines &= ((uint64_t)1 << skipped) - 1;
+            scanner->line += __builtin_popcountll(newlines);
+            if (stopAt(scanner, scanner->current + skipped))
+            {
+                return;
+            }
+            continue;
+        }
+        scanner->line += __builtin_popcountll(newlines);
+        stopAt(scanner, block->base + SCAN_BLOCK_SIZE);
+    }
 }
 
-static void skipWhitespace()
+static void findNewline(Scanner *scanner)
 {
     for (;;)
     {
-        char c = peek();
+        scanner->start = scanner->current;
+        if (isAtEnd(scanner))
+        {
+            return;
+        }
+        ScanBlock *block = loadBlock(scanner, scanner->current);
+        int offset = (int)(scanner->current - block->base);
+        uint64_t newlines = block->newline >> offset;
+        if (newlines != 0 && stopAt(scanner, scanner->current + __builtin_ctzll(newlines)))
+        {
+            return;
+        }
+        stopAt(scanner, block->base + SCAN_BLOCK_SIZE);
+    }
+}
+
+static void findQuote(Scanner *scanner)
+{
+    while (!isAtEnd(scanner))
+    {
+        ScanBlock *block = loadBlock(scanner, scanner->current);
+        int offset = (int)(scanner->current - block->base);
+        uint64_t quotes = block->quote >> offset;
+        uint64_t newlines = block->newline >> offset;
+        if (quotes != 0)
+        {
+            int skipped = __builtin_ctzll(quotes);
+            newlines &= ((uint64_t)1 << skipped) - 1;
+            scanner->line += __builtin_popcountll(newlines);
+            if (stopAt(scanner, scanner->current + skipped))
+            {
+                return;
+            }
+            continue;
+        }
+        scanner->line += __builtin_popcountll(newlines);
+        stopAt(scanner, block->base + SCAN_BLOCK_SIZE);
+    }
+}
+
+static void skipIdentifier(Scanner *scanner)
+{
+    while (!isAtEnd(scanner))
+    {
+        ScanBlock *block = loadBlock(scanner, scanner->current);
+        int offset = (int)(scanner->current - block->base);
+        uint64_t other = ~block->identifier >> offset;
+        if (other != 0 && stopAt(scanner, scanner->current + __builtin_ctzll(other)))
+        {
+            return;
+        }
+        stopAt(scanner, block->base + SCAN_BLOCK_SIZE);
+    }
+}
+
+static void skipWhitespace(Scanner *scanner)
+{
+    for (;;)
+    {
+        // Most tokens are separated by at most one space, which is not
+        // worth a trip through the block masks.
+        char c = peek(scanner);
+        if (c == ' ')
+        {
+            scanner->current++;
+            c = peek(scanner);
+        }
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+        {
+            skipBlank(scanner);
+        }
+        if (peek(scanner) == '/' && peekNext(scanner) == '/')
+        {
+            // A comment goes until the end of the line.
+            findNewline(scanner);
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+#else
+
+static void skipWhitespace(Scanner *scanner)
+{
+    for (;;)
+    {
+        // Nothing skipped needs to survive a refill.
+        scanner->start = scanner->current;
+        char c = peek(scanner);
         switch (c)
         {
         case ' ':
         case '\r':
         case '\t':
-            advance();
+            advance(scanner);
             break;
         case '\n':
-            scanner.line++;
-            advance();
+            scanner->line++;
+            advance(scanner);
             break;
         case '/':
-            if (peekNext() == '/')
+            if (peekNext(scanner) == '/')
             {
                 // A comment goes until the end of the line.
-                while (peek() != '\n' && !isAtEnd())
-                    advance();
+                while (peek(scanner) != '\n' && !isAtEnd(scanner))
+                    advance(scanner);
             }
             else
             {
@@ -110,6 +429,9 @@ static void skipWhitespace()
         }
     }
 }
+
+#endif
+
 static bool isDigit(char c)
 {
     return c >= '0' && c <= '9';
@@ -122,11 +444,11 @@ static bool isAlpha(char c)
            c == '_';
 }
 
-static TokenType checkKeyword(int start, int length,
+static TokenType checkKeyword(Scanner *scanner, int start, int length,
                               const char *rest, TokenType type)
 {
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0)
+    if (scanner->current - scanner->start == start + length &&
+        memcmp(scanner->start + start, rest, length) == 0)
     {
         return type;
     }
@@ -134,154 +456,179 @@ static TokenType checkKeyword(int start, int length,
     return TOKEN_IDENTIFIER;
 }
 
-static TokenType identifierType()
+static TokenType identifierType(Scanner *scanner)
 {
-    switch (scanner.start[0])
+    switch (scanner->start[0])
     {
     case 'a':
-        return checkKeyword(1, 2, "nd", TOKEN_AND);
+        return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
     case 'c':
-        return checkKeyword(1, 4, "lass", TOKEN_CLASS);
+        return checkKeyword(scanner, 1, 4, "lass", TOKEN_CLASS);
     case 'e':
-        return checkKeyword(1, 3, "lse", TOKEN_ELSE);
+        return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
     case 'f':
-        if (scanner.current - scanner.start > 1)
+        if (scanner->current - scanner->start > 1)
         {
-            switch (scanner.start[1])
+            switch (scanner->start[1])
             {
             case 'a':
-                return checkKeyword(2, 3, "lse", TOKEN_FALSE);
+                return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
             case 'o':
-                return checkKeyword(2, 1, "r", TOKEN_FOR);
+                return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
             case 'u':
-                return checkKeyword(2, 1, "n", TOKEN_FUN);
+                return checkKeyword(scanner, 2, 1, "n", TOKEN_FUN);
             }
         }
         break;
     case 'i':
-        return checkKeyword(1, 1, "f", TOKEN_IF);
+        return checkKeyword(scanner, 1, 1, "f", TOKEN_IF);
     case 'n':
-        return checkKeyword(1, 2, "il", TOKEN_NIL);
+        return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
     case 'o':
-        return checkKeyword(1, 1, "r", TOKEN_OR);
+        return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
     case 'p':
-        return checkKeyword(1, 4, "rint", TOKEN_PRINT);
+        return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
     case 'r':
-        return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
+        return checkKeyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
     case 's':
-        return checkKeyword(1, 4, "uper", TOKEN_SUPER);
+        return checkKeyword(scanner, 1, 4, "uper", TOKEN_SUPER);
     case 't':
-        if (scanner.current - scanner.start > 1)
+        if (scanner->current - scanner->start > 1)
         {
-            switch (scanner.start[1])
+            switch (scanner->start[1])
             {
             case 'h':
-                return checkKeyword(2, 2, "is", TOKEN_THIS);
+                return checkKeyword(scanner, 2, 2, "is", TOKEN_THIS);
             case 'r':
-                return checkKeyword(2, 2, "ue", TOKEN_TRUE);
+                return checkKeyword(scanner, 2, 2, "ue", TOKEN_TRUE);
             }
         }
         break;
     case 'v':
-        return checkKeyword(1, 2, "ar", TOKEN_VAR);
+        return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
     case 'w':
-        return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+        return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
     }
 
     return TOKEN_IDENTIFIER;
 }
 
-static Token string()
+static Token string(Scanner *scanner)
 {
-    while (peek() != '"' && !isAtEnd())
+#ifdef SCANNER_SIMD
+    findQuote(scanner);
+#else
+    while (peek(scanner) != '"' && !isAtEnd(scanner))
     {
-        if (peek() == '\n')
-            scanner.line++;
-        advance();
+        if (peek(scanner) == '\n')
+            scanner->line++;
+        advance(scanner);
     }
+#endif
 
-    if (isAtEnd())
-        return errorToken("Unterminated string.");
+    if (isAtEnd(scanner))
+        return errorToken(scanner, "Unterminated string.");
 
     // The closing ".
-    advance();
-    return makeToken(TOKEN_STRING);
+    advance(scanner);
+    return makeToken(scanner, TOKEN_STRING);
 }
 
-static Token number()
+static Token number(Scanner *scanner)
 {
-    while (isDigit(peek()))
-        advance();
+    while (isDigit(peek(scanner)))
+        advance(scanner);
 
     // Look for a fractional part.
-    if (peek() == '.' && isDigit(peekNext()))
+    if (peek(scanner) == '.' && isDigit(peekNext(scanner)))
     {
         // Consume the "."
-        advance();
+        advance(scanner);
 
-        while (isDigit(peek()))
-            advance();
+        while (isDigit(peek(scanner)))
+            advance(scanner);
     }
 
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(scanner, TOKEN_NUMBER);
 }
 
-static Token identifier()
+static Token identifier(Scanner *scanner)
 {
-    while (isAlpha(peek()) || isDigit(peek()))
-        advance();
+#ifdef SCANNER_SIMD
+    // Short names are done before the block masks would pay off.
+    for (int i = 0; i < 8; i++)
+    {
+        if (!isAlpha(peek(scanner)) && !isDigit(peek(scanner)))
+        {
+            return makeToken(scanner, identifierType(scanner));
+        }
+        advance(scanner);
+    }
+    skipIdentifier(scanner);
+#else
+    while (isAlpha(peek(scanner)) || isDigit(peek(scanner)))
+        advance(scanner);
+#endif
 
-    return makeToken(identifierType());
+    return makeToken(scanner, identifierType(scanner));
 }
 
-Token scanToken()
+static Token scanNext(Scanner *scanner)
 {
-    skipWhitespace();
-    scanner.start = scanner.current;
-    if (isAtEnd())
-        return makeToken(TOKEN_EOF);
+    scanner->start = scanner->current;
+    skipWhitespace(scanner);
+    scanner->start = scanner->current;
+    if (isAtEnd(scanner))
+        return makeToken(scanner, TOKEN_EOF);
 
-    char c = advance();
+    char c = advance(scanner);
     if (isAlpha(c))
-        return identifier();
+        return identifier(scanner);
     if (isDigit(c))
-        return number();
+        return number(scanner);
 
     switch (c)
     {
     case '(':
-        return makeToken(TOKEN_LEFT_PAREN);
+        return makeToken(scanner, TOKEN_LEFT_PAREN);
     case ')':
-        return makeToken(TOKEN_RIGHT_PAREN);
+        return makeToken(scanner, TOKEN_RIGHT_PAREN);
     case '{':
-        return makeToken(TOKEN_LEFT_BRACE);
+        return makeToken(scanner, TOKEN_LEFT_BRACE);
     case '}':
-        return makeToken(TOKEN_RIGHT_BRACE);
+        return makeToken(scanner, TOKEN_RIGHT_BRACE);
     case ';':
-        return makeToken(TOKEN_SEMICOLON);
+        return makeToken(scanner, TOKEN_SEMICOLON);
     case ',':
-        return makeToken(TOKEN_COMMA);
+        return makeToken(scanner, TOKEN_COMMA);
     case '.':
-        return makeToken(TOKEN_DOT);
+        return makeToken(scanner, TOKEN_DOT);
     case '-':
-        return makeToken(TOKEN_MINUS);
+        return makeToken(scanner, TOKEN_MINUS);
     case '+':
-        return makeToken(TOKEN_PLUS);
+        return makeToken(scanner, TOKEN_PLUS);
     case '/':
-        return makeToken(TOKEN_SLASH);
+        return makeToken(scanner, TOKEN_SLASH);
     case '*':
-        return makeToken(TOKEN_STAR);
+        return makeToken(scanner, TOKEN_STAR);
     case '!':
-        return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+        return makeToken(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
     case '=':
-        return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+        return makeToken(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
     case '<':
-        return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+        return makeToken(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
     case '>':
-        return makeToken(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+        return makeToken(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
     case '"':
-        return string();
+        return string(scanner);
     }
 
-    return errorToken("Unexpected character.");
+    return errorToken(scanner, "Unexpected character.");
+}
+
+Token scanToken(Scanner *scanner)
+{
+    Token token = scanNext(scanner);
+    scanner->tokenWindow = scanner->window;
+    return token;
 }
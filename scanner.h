@@ -1,6 +1,10 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include <stdio.h>
+
+#include "common.h"
+
 typedef enum
 {
     // Single-character tokens.
@@ -61,7 +65,45 @@ typedef struct
     int line;
 } Token;
 
-void initScanner(const char *source);
-Token scanToken();
+#define SCAN_BLOCK_SIZE 64
+
+// Character classes of one 64-byte block of source, one bit per byte.
+typedef struct
+{
+    const char *base;
+    uint64_t blank;
+    uint64_t newline;
+    uint64_t quote;
+    uint64_t identifier;
+} ScanBlock;
+
+// A streaming scanner reads this much at a time.
+#define SCAN_STREAM_SIZE (64 * 1024)
+
+// The scanner works on the window [source, end). For a stream the window
+// is refilled when the scanner reaches its end, carrying the partial
+// token over. Refills alternate between two buffers, so the text of the
+// last token returned stays valid while the next one is scanned.
+typedef struct
+{
+    const char *source;
+    const char *end;
+    const char *start;
+    const char *current;
+    int line;
+    ScanBlock block;
+
+    FILE *stream; // NULL once the stream is exhausted.
+    char *buffers[2];
+    size_t capacities[2];
+    int window;
+    int tokenWindow;
+    size_t length; // Bytes of source seen so far.
+} Scanner;
+
+void initScanner(Scanner *scanner, const char *source, size_t length);
+void initStreamScanner(Scanner *scanner, FILE *stream);
+void freeScanner(Scanner *scanner);
+Token scanToken(Scanner *scanner);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "compiler.h"
+#include "scheduler.h"
+
+static uint64_t nowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void initScheduler(Scheduler *scheduler, uint64_t fuel)
+{
+    scheduler->head = NULL;
+    scheduler->tail = NULL;
+    scheduler->fuel = fuel;
+    scheduler->tasks = 0;
+    scheduler->errors = 0;
+    scheduler->slices = 0;
+    scheduler->sliceNs = 0;
+    scheduler->maxSliceNs = 0;
+    scheduler->waits = 0;
+    scheduler->waitNs = 0;
+    scheduler->maxWaitNs = 0;
+    scheduler->switchNs = 0;
+    scheduler->elapsedNs = 0;
+    scheduler->preempted = 0;
+    scheduler->shareSum = 0;
+    scheduler->shareSquares = 0;
+}
+
+static void enqueue(Scheduler *scheduler, Task *task)
+{
+    task->next = NULL;
+    if (scheduler->tail == NULL)
+    {
+        scheduler->head = task;
+    }
+    else
+    {
+        scheduler->tail->next = task;
+    }
+    scheduler->tail = task;
+}
+
+static Task *dequeue(Scheduler *scheduler)
+{
+    Task *task = scheduler->head;
+    if (task != NULL)
+    {
+        scheduler->head = task->next;
+        if (scheduler->head == NULL)
+        {
+            scheduler->tail = NULL;
+        }
+    }
+    return task;
+}
+
+static void freeTask(Task *task)
+{
+    freeChunk(&task->vm, &task->chunk);
+    freeArena(&task->arena);
+    freeVM(&task->vm);
+    free(task);
+}
+
+// Compiles source, or stream when it is not NULL, into a new task at the
+// back of the run queue. The source is not needed afterwards. Returns
+// false after reporting a compile error.
+static bool spawn(Scheduler *scheduler, const char *source, size_t length, FILE *stream)
+{
+    Task *task = (Task *)malloc(sizeof(Task));
+    if (task == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(74);
+    }
+    initVM(&task->vm);
+    initArena(&task->arena, &task->vm);
+    initChunk(&task->chunk);
+    bool compiled = stream != NULL ? compileStream(&task->vm, stream, &task->chunk, &task->arena)
+                                   : compile(&task->vm, source, length, &task->chunk, &task->arena);
+    if (!compiled)
+    {
+        freeTask(task);
+        return false;
+    }
+    task->started = false;
+    task->queuedNs = 0;
+    task->yields = 0;
+    task->yieldedNs = 0;
+    enqueue(scheduler, task);
+    scheduler->tasks++;
+    return true;
+}
+
+bool spawnTask(Scheduler *scheduler, const char *source, size_t length)
+{
+    return spawn(scheduler, source, length, NULL);
+}
+
+bool spawnStreamTask(Scheduler *scheduler, FILE *stream)
+{
+    return spawn(scheduler, NULL, 0, stream);
+}
+
+static void finishTask(Scheduler *scheduler, Task *task, InterpretResult result)
+{
+    if (result != INTERPRET_OK)
+    {
+        scheduler->errors++;
+    }
+    if (task->yields > 0)
+    {
+        double share = (double)task->yieldedNs / (double)task->yields;
+        scheduler->preempted++;
+        scheduler->shareSum += share;
+        scheduler->shareSquares += share * share;
+    }
+    freeTask(task);
+}
+
+// Runs slices round robin until every task has finished.
+void runScheduler(Scheduler *scheduler)
+{
+    uint64_t start = nowNs();
+    uint64_t last = start;
+    Task *task;
+    while ((task = dequeue(scheduler)) != NULL)
+    {
+        uint64_t sliceStart = nowNs();
+        scheduler->switchNs += sliceStart - last;
+        if (task->started)
+        {
+            uint64_t wait = sliceStart - task->queuedNs;
+            scheduler->waits++;
+            scheduler->waitNs += wait;
+            scheduler->maxWaitNs = wait > scheduler->maxWaitNs ? wait : scheduler->maxWaitNs;
+        }
+
+        task->vm.fuelLimit = task->vm.instructions + scheduler->fuel;
+        InterpretResult result;
+        if (task->started)
+        {
+            result = resumeVM(&task->vm);
+        }
+        else
+        {
+            task->started = true;
+            result = interpretChunk(&task->vm, &task->chunk);
+        }
+
+        last = nowNs();
+        uint64_t slice = last - sliceStart;
+        scheduler->slices++;
+        scheduler->sliceNs += slice;
+        scheduler->maxSliceNs = slice > scheduler->maxSliceNs ? slice : scheduler->maxSliceNs;
+        if (result == INTERPRET_YIELD)
+        {
+            task->yields++;
+            task->yieldedNs += slice;
+            task->queuedNs = last;
+            enqueue(scheduler, task);
+        }
+        else
+        {
+            finishTask(scheduler, task, result);
+            last = nowNs();
+        }
+    }
+    scheduler->elapsedNs = last - start;
+}
+
+static double perMicro(uint64_t ns, uint64_t count)
+{
+    return count == 0 ? 0 : (double)ns / (double)count / 1000.0;
+}
+
+// Switch time is what the scheduler spends between two slices, freeing
+// finished tasks aside. Fairness is Jain's index over the mean time the
+// preempted tasks got per full slice: 1 when every task got the same.
+void reportScheduler(Scheduler *scheduler, FILE *file)
+{
+    double fairness = 1;
+    if (scheduler->preempted > 0 && scheduler->shareSquares > 0)
+    {
+        fairness = scheduler->shareSum * scheduler->shareSum /
+                   ((double)scheduler->preempted * scheduler->shareSquares);
+    }
+    fprintf(file, "== scheduler ==\n");
+    fprintf(file, "%-14s %d (%d failed, %d preempted)\n", "tasks",
+            scheduler->tasks, scheduler->errors, scheduler->preempted);
+    fprintf(file, "%-14s %llu instructions\n", "fuel", (unsigned long long)scheduler->fuel);
+    fprintf(file, "%-14s %llu\n", "slices", (unsigned long long)scheduler->slices);
+    fprintf(file, "%-14s mean %.1f us, max %.1f us\n", "slice time",
+            perMicro(scheduler->sliceNs, scheduler->slices), scheduler->maxSliceNs / 1000.0);
+    fprintf(file, "%-14s mean %.1f us, max %.1f us\n", "queue wait",
+            perMicro(scheduler->waitNs, scheduler->waits), scheduler->maxWaitNs / 1000.0);
+    fprintf(file, "%-14s mean %.3f us, %.2f%% of %.1f ms\n", "switch time",
+            perMicro(scheduler->switchNs, scheduler->slices),
+            scheduler->elapsedNs == 0 ? 0 : 100.0 * (double)scheduler->switchNs / (double)scheduler->elapsedNs,
+            scheduler->elapsedNs / 1e6);
+    fprintf(file, "%-14s %.4f\n", "fairness", fairness);
+}
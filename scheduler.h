@@ -0,0 +1,61 @@
+#ifndef clox_scheduler_h
+#define clox_scheduler_h
+
+#include <stdio.h>
+
+#include "arena.h"
+#include "chunk.h"
+#include "common.h"
+#include "vm.h"
+
+// The scheduler interleaves many scripts on the calling thread. Each one
+// runs in a VM of its own and gets fuel instructions per slice; when they
+// run out the script yields at its next backward jump or call and goes to
+// the back of the run queue. Finished scripts are freed right away.
+#define SCHEDULER_DEFAULT_FUEL 10000
+
+typedef struct sTask
+{
+    VM vm;
+    Arena arena;
+    Chunk chunk;
+    bool started;
+    uint64_t queuedNs;
+    // Slices that ended by yielding. The last, usually partial, slice is
+    // not counted.
+    uint64_t yields;
+    uint64_t yieldedNs;
+    struct sTask *next;
+} Task;
+
+typedef struct
+{
+    Task *head;
+    Task *tail;
+    uint64_t fuel;
+
+    // Totals reported by reportScheduler().
+    int tasks;
+    int errors;
+    uint64_t slices;
+    uint64_t sliceNs;
+    uint64_t maxSliceNs;
+    uint64_t waits;
+    uint64_t waitNs;
+    uint64_t maxWaitNs;
+    uint64_t switchNs;
+    uint64_t elapsedNs;
+    // Sums over the preempted tasks of their mean time per full slice,
+    // for Jain's fairness index.
+    int preempted;
+    double shareSum;
+    double shareSquares;
+} Scheduler;
+
+void initScheduler(Scheduler *scheduler, uint64_t fuel);
+bool spawnTask(Scheduler *scheduler, const char *source, size_t length);
+bool spawnStreamTask(Scheduler *scheduler, FILE *stream);
+void runScheduler(Scheduler *scheduler);
+void reportScheduler(Scheduler *scheduler, FILE *file);
+
+#endif
@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "memory.h"
+#include "server.h"
+#include "vm.h"
+
+typedef struct
+{
+    uint32_t hash;
+    int length;
+    char *source;
+    Chunk chunk;
+} CachedChunk;
+
+typedef struct
+{
+    VM vm;
+    bool cacheChunks;
+    CachedChunk cache[SERVER_CACHE_SIZE];
+    Table session;
+    // The globals initVM() defines, copied into every fresh set of
+    // globals a request or session starts from.
+    Table natives;
+} Server;
+
+static void startVM(Server *server)
+{
+    initVM(&server->vm);
+    initTable(&server->natives);
+    tableAddAll(&server->vm, &server->vm.globals, &server->natives);
+}
+
+static void stopVM(Server *server)
+{
+    freeTable(&server->vm, &server->natives);
+    freeVM(&server->vm);
+}
+
+static void resetGlobals(Server *server, Table *globals)
+{
+    freeTable(&server->vm, globals);
+    initTable(globals);
+    tableAddAll(&server->vm, &server->natives, globals);
+}
+
+static void initCache(Server *server)
+{
+    for (int i = 0; i < SERVER_CACHE_SIZE; i++)
+    {
+        server->cache[i].source = NULL;
+        initChunk(&server->cache[i].chunk);
+    }
+}
+
+static void freeCache(Server *server)
+{
+    for (int i = 0; i < SERVER_CACHE_SIZE; i++)
+    {
+        CachedChunk *entry = &server->cache[i];
+        if (entry->source != NULL)
+        {
+            free(entry->source);
+            freeChunk(&server->vm, &entry->chunk);
+            entry->source = NULL;
+        }
+    }
+}
+
+static uint32_t hashSource(const char *source, int length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)source[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+// Returns the cached chunk for source, compiling it on a miss. NULL means
+// the source did not compile.
+static Chunk *cachedChunk(Server *server, const char *source, int length)
+{
+    uint32_t hash = hashSource(source, length);
+    CachedChunk *entry = &server->cache[hash % SERVER_CACHE_SIZE];
+    if (entry->source != NULL && entry->hash == hash && entry->length == length &&
+        memcmp(entry->source, source, length) == 0)
+    {
+        return &entry->chunk;
+    }
+
+    Chunk chunk;
+    initChunk(&chunk);
+    if (!compile(&server->vm, source, length, &chunk, NULL))
+    {
+        freeChunk(&server->vm, &chunk);
+        return NULL;
+    }
+
+    if (entry->source != NULL)
+    {
+        free(entry->source);
+        freeChunk(&server->vm, &entry->chunk);
+    }
+    entry->source = (char *)malloc(length);
+    memcpy(entry->source, source, length);
+    entry->hash = hash;
+    entry->length = length;
+    entry->chunk = chunk;
+    return &entry->chunk;
+}
+
+static bool readFully(int fd, void *buffer, size_t size)
+{
+    char *bytes = (char *)buffer;
+    while (size > 0)
+    {
+        ssize_t count = read(fd, bytes, size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const void *buffer, size_t size)
+{
+    const char *bytes = (const char *)buffer;
+    while (size > 0)
+    {
+        ssize_t count = write(fd, bytes, size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+static bool writeLength(int fd, uint32_t length)
+{
+    uint8_t bytes[4] = {length >> 24, length >> 16, length >> 8, length};
+    return writeFully(fd, bytes, sizeof(bytes));
+}
+
+static InterpretResult evaluate(Server *server, char kind, const char *source, int length)
+{
+    VM *vm = &server->vm;
+    if (kind == 'E')
+    {
+        Table globals = vm->globals;
+        vm->globals = server->session;
+        InterpretResult result = interpret(vm, source, length);
+        server->session = vm->globals;
+        vm->globals = globals;
+        return result;
+    }
+
+    InterpretResult result;
+    if (server->cacheChunks)
+    {
+        Chunk *chunk = cachedChunk(server, source, length);
+        result = chunk != NULL ? interpretChunk(vm, chunk) : INTERPRET_COMPILE_ERROR;
+    }
+    else
+    {
+        result = interpret(vm, source, length);
+    }
+
+    resetGlobals(server, &vm->globals);
+    return result;
+}
+
+static bool handleRequest(Server *server, int fd, char **payload, size_t *capacity)
+{
+    uint8_t header[5];
+    if (!readFully(fd, header, sizeof(header)))
+    {
+        return false;
+    }
+    char kind = (char)header[0];
+    uint32_t length = ((uint32_t)header[1] << 24) | ((uint32_t)header[2] << 16) |
+                      ((uint32_t)header[3] << 8) | header[4];
+    if ((kind != 'S' && kind != 'E') || length > INT32_MAX - 1)
+    {
+        return false;
+    }
+
+    if (*capacity < length + 1)
+    {
+        char *grown = (char *)realloc(*payload, length + 1);
+        if (grown == NULL)
+        {
+            return false;
+        }
+        *payload = grown;
+        *capacity = length + 1;
+    }
+    if (!readFully(fd, *payload, length))
+    {
+        return false;
+    }
+    (*payload)[length] = '\0';
+
+    char *output = NULL;
+    size_t outputSize = 0;
+    char *errors = NULL;
+    size_t errorsSize = 0;
+    server->vm.output = open_memstream(&output, &outputSize);
+    server->vm.errors = open_memstream(&errors, &errorsSize);
+
+    InterpretResult result = evaluate(server, kind, *payload, (int)length);
+
+    fclose(server->vm.output);
+    fclose(server->vm.errors);
+    server->vm.output = stdout;
+    server->vm.errors = stderr;
+
+    uint8_t status = (uint8_t)result;
+    bool sent = writeFully(fd, &status, 1) &&
+                writeLength(fd, (uint32_t)outputSize) && writeFully(fd, output, outputSize) &&
+                writeLength(fd, (uint32_t)errorsSize) && writeFully(fd, errors, errorsSize);
+    free(output);
+    free(errors);
+    return sent;
+}
+
+static void handleConnection(Server *server, int fd)
+{
+    char *payload = NULL;
+    size_t capacity = 0;
+    initTable(&server->session);
+    tableAddAll(&server->vm, &server->natives, &server->session);
+
+    while (handleRequest(server, fd, &payload, &capacity))
+        ;
+
+    freeTable(&server->vm, &server->session);
+    free(payload);
+
+    // Nothing is ever collected, so a long-running server starts over
+    // once enough distinct strings have been interned.
+    if (server->vm.strings.count > SERVER_MAX_STRINGS)
+    {
+        freeCache(server);
+        stopVM(server);
+        startVM(server);
+    }
+}
+
+int serve(const char *path, bool cacheChunks)
+{
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+        return 64;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        perror("socket");
+        return 74;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listener, 16) < 0)
+    {
+        perror(path);
+        close(listener);
+        return 74;
+    }
+
+    // A client hanging up mid-response must not take the server down.
+    signal(SIGPIPE, SIG_IGN);
+
+    Server *server = (Server *)malloc(sizeof(Server));
+    startVM(server);
+    server->cacheChunks = cacheChunks;
+    initCache(server);
+
+    for (;;)
+    {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        handleConnection(server, fd);
+        close(fd);
+    }
+
+    freeCache(server);
+    stopVM(server);
+    free(server);
+    close(listener);
+    unlink(path);
+    return 74;
+}
@@ -0,0 +1,23 @@
+#ifndef clox_server_h
+#define clox_server_h
+
+#include "common.h"
+
+// The server answers requests on a Unix domain socket with one warm VM,
+// so interned strings and, with caching on, compiled chunks carry over
+// between requests.
+//
+// A request is a kind byte, a 32-bit big-endian payload length and the
+// payload:
+//   'S'  run the payload as a script against empty globals.
+//   'E'  evaluate the payload in the connection's session, whose globals
+//        persist until the connection is closed.
+// The response is the InterpretResult as one byte, followed by the
+// printed output and the error text, each preceded by a 32-bit
+// big-endian length.
+#define SERVER_CACHE_SIZE 256
+#define SERVER_MAX_STRINGS (1 << 20)
+
+int serve(const char *path, bool cacheChunks);
+
+#endif
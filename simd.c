@@ -0,0 +1,430 @@
+#include "simd.h"
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+static inline double applyOp(SimdOp op, double a, double b)
+{
+    switch (op)
+    {
+    case SIMD_ADD:
+        return a + b;
+    case SIMD_SUBTRACT:
+        return a - b;
+    case SIMD_MULTIPLY:
+        return a * b;
+    case SIMD_DIVIDE:
+        return a / b;
+    }
+    return a;
+}
+
+#ifdef SIMD_X86
+
+// The AVX2 kernels are compiled for AVX2 whatever the build targets and
+// only called after checking the CPU, so one binary runs everywhere.
+#define AVX2 __attribute__((target("avx2")))
+
+static bool hasAvx2()
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#define KERNEL(name, ...) \
+    (hasAvx2() ? name##Avx2(__VA_ARGS__) : name##Sse2(__VA_ARGS__))
+
+// SSE2, two lanes. The loops that reduce run two accumulators to hide
+// the latency of the additions.
+
+static inline double addLanesSse2(__m128d vector)
+{
+    return _mm_cvtsd_f64(_mm_add_sd(vector, _mm_unpackhi_pd(vector, vector)));
+}
+
+static double sumSse2(const double *values, int count)
+{
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        sum0 = _mm_add_pd(sum0, _mm_load_pd(values + i));
+        sum1 = _mm_add_pd(sum1, _mm_load_pd(values + i + 2));
+    }
+    double sum = addLanesSse2(_mm_add_pd(sum0, sum1));
+    for (; i < count; i++)
+    {
+        sum += values[i];
+    }
+    return sum;
+}
+
+static double dotSse2(const double *a, const double *b, int count)
+{
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_load_pd(a + i), _mm_load_pd(b + i)));
+        sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_load_pd(a + i + 2), _mm_load_pd(b + i + 2)));
+    }
+    double sum = addLanesSse2(_mm_add_pd(sum0, sum1));
+    for (; i < count; i++)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static double minSse2(const double *values, int count)
+{
+    __m128d min = _mm_set1_pd(values[0]);
+    int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        min = _mm_min_pd(min, _mm_load_pd(values + i));
+    }
+    min = _mm_min_sd(min, _mm_unpackhi_pd(min, min));
+    double result = _mm_cvtsd_f64(min);
+    for (; i < count; i++)
+    {
+        result = values[i] < result ? values[i] : result;
+    }
+    return result;
+}
+
+static double maxSse2(const double *values, int count)
+{
+    __m128d max = _mm_set1_pd(values[0]);
+    int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        max = _mm_max_pd(max, _mm_load_pd(values + i));
+    }
+    max = _mm_max_sd(max, _mm_unpackhi_pd(max, max));
+    double result = _mm_cvtsd_f64(max);
+    for (; i < count; i++)
+    {
+        result = values[i] > result ? values[i] : result;
+    }
+    return result;
+}
+
+static void mapSse2(double *values, int count, SimdOp op, double operand)
+{
+    __m128d vectorOperand = _mm_set1_pd(operand);
+    int i = 0;
+#define MAP_LOOP(vectorOp)                                                          \
+    for (; i + 2 <= count; i += 2)                                                  \
+    {                                                                               \
+        _mm_store_pd(values + i, vectorOp(_mm_load_pd(values + i), vectorOperand)); \
+    }                                                                               \
+    break
+
+    switch (op)
+    {
+    case SIMD_ADD:
+        MAP_LOOP(_mm_add_pd);
+    case SIMD_SUBTRACT:
+        MAP_LOOP(_mm_sub_pd);
+    case SIMD_MULTIPLY:
+        MAP_LOOP(_mm_mul_pd);
+    case SIMD_DIVIDE:
+        MAP_LOOP(_mm_div_pd);
+    }
+#undef MAP_LOOP
+    for (; i < count; i++)
+    {
+        values[i] = applyOp(op, values[i], operand);
+    }
+}
+
+static void addSse2(double *to, const double *from, int count)
+{
+    int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        _mm_store_pd(to + i, _mm_add_pd(_mm_load_pd(to + i), _mm_load_pd(from + i)));
+    }
+    for (; i < count; i++)
+    {
+        to[i] += from[i];
+    }
+}
+
+// Scans each pair in its register, then adds the running total carried
+// over from the pairs before it.
+static void prefixSumSse2(double *values, int count)
+{
+    __m128d carry = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128d pair = _mm_load_pd(values + i);
+        pair = _mm_add_pd(pair, _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(pair), 8)));
+        pair = _mm_add_pd(pair, carry);
+        _mm_store_pd(values + i, pair);
+        carry = _mm_unpackhi_pd(pair, pair);
+    }
+    double total = _mm_cvtsd_f64(carry);
+    for (; i < count; i++)
+    {
+        total += values[i];
+        values[i] = total;
+    }
+}
+
+// AVX2, four lanes.
+
+AVX2 static inline double addLanesAvx2(__m256d vector)
+{
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(vector), _mm256_extractf128_pd(vector, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+AVX2 static double sumAvx2(const double *values, int count)
+{
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        sum0 = _mm256_add_pd(sum0, _mm256_load_pd(values + i));
+        sum1 = _mm256_add_pd(sum1, _mm256_load_pd(values + i + 4));
+    }
+    double sum = addLanesAvx2(_mm256_add_pd(sum0, sum1));
+    for (; i < count; i++)
+    {
+        sum += values[i];
+    }
+    return sum;
+}
+
+AVX2 static double dotAvx2(const double *a, const double *b, int count)
+{
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_load_pd(a + i), _mm256_load_pd(b + i)));
+        sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_load_pd(a + i + 4), _mm256_load_pd(b + i + 4)));
+    }
+    double sum = addLanesAvx2(_mm256_add_pd(sum0, sum1));
+    for (; i < count; i++)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+AVX2 static double minAvx2(const double *values, int count)
+{
+    __m256d min = _mm256_set1_pd(values[0]);
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        min = _mm256_min_pd(min, _mm256_load_pd(values + i));
+    }
+    __m128d half = _mm_min_pd(_mm256_castpd256_pd128(min), _mm256_extractf128_pd(min, 1));
+    double result = _mm_cvtsd_f64(_mm_min_sd(half, _mm_unpackhi_pd(half, half)));
+    for (; i < count; i++)
+    {
+        result = values[i] < result ? values[i] : result;
+    }
+    return result;
+}
+
+AVX2 static double maxAvx2(const double *values, int count)
+{
+    __m256d max = _mm256_set1_pd(values[0]);
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        max = _mm256_max_pd(max, _mm256_load_pd(values + i));
+    }
+    __m128d half = _mm_max_pd(_mm256_castpd256_pd128(max), _mm256_extractf128_pd(max, 1));
+    double result = _mm_cvtsd_f64(_mm_max_sd(half, _mm_unpackhi_pd(half, half)));
+    for (; i < count; i++)
+    {
+        result = values[i] > result ? values[i] : result;
+    }
+    return result;
+}
+
+AVX2 static void mapAvx2(double *values, int count, SimdOp op, double operand)
+{
+    __m256d vectorOperand = _mm256_set1_pd(operand);
+    int i = 0;
+#define MAP_LOOP(vectorOp)                                                                \
+    for (; i + 4 <= count; i += 4)                                                        \
+    {                                                                                     \
+        _mm256_store_pd(values + i, vectorOp(_mm256_load_pd(values + i), vectorOperand)); \
+    }                                                                                     \
+    break
+
+    switch (op)
+    {
+    case SIMD_ADD:
+        MAP_LOOP(_mm256_add_pd);
+    case SIMD_SUBTRACT:
+        MAP_LOOP(_mm256_sub_pd);
+    case SIMD_MULTIPLY:
+        MAP_LOOP(_mm256_mul_pd);
+    case SIMD_DIVIDE:
+        MAP_LOOP(_mm256_div_pd);
+    }
+#undef MAP_LOOP
+    for (; i < count; i++)
+    {
+        values[i] = applyOp(op, values[i], operand);
+    }
+}
+
+AVX2 static void addAvx2(double *to, const double *from, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm256_store_pd(to + i, _mm256_add_pd(_mm256_load_pd(to + i), _mm256_load_pd(from + i)));
+    }
+    for (; i < count; i++)
+    {
+        to[i] += from[i];
+    }
+}
+
+// Two shift-and-add steps scan the four lanes: [a, b, c, d] becomes
+// [a, a+b, b+c, c+d] and then [a, a+b, a+b+c, a+b+c+d].
+AVX2 static void prefixSumAvx2(double *values, int count)
+{
+    __m256d zero = _mm256_setzero_pd();
+    __m256d carry = zero;
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d lanes = _mm256_load_pd(values + i);
+        lanes = _mm256_add_pd(lanes, _mm256_blend_pd(_mm256_permute4x64_pd(lanes, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x1));
+        lanes = _mm256_add_pd(lanes, _mm256_blend_pd(_mm256_permute4x64_pd(lanes, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x3));
+        lanes = _mm256_add_pd(lanes, carry);
+        _mm256_store_pd(values + i, lanes);
+        carry = _mm256_permute4x64_pd(lanes, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    double total = _mm256_cvtsd_f64(carry);
+    for (; i < count; i++)
+    {
+        total += values[i];
+        values[i] = total;
+    }
+}
+
+#else
+
+#define KERNEL(name, ...) name##Scalar(__VA_ARGS__)
+
+static double sumScalar(const double *values, int count)
+{
+    double sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        sum += values[i];
+    }
+    return sum;
+}
+
+static double dotScalar(const double *a, const double *b, int count)
+{
+    double sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static double minScalar(const double *values, int count)
+{
+    double result = values[0];
+    for (int i = 1; i < count; i++)
+    {
+        result = values[i] < result ? values[i] : result;
+    }
+    return result;
+}
+
+static double maxScalar(const double *values, int count)
+{
+    double result = values[0];
+    for (int i = 1; i < count; i++)
+    {
+        result = values[i] > result ? values[i] : result;
+    }
+    return result;
+}
+
+static void mapScalar(double *values, int count, SimdOp op, double operand)
+{
+    for (int i = 0; i < count; i++)
+    {
+        values[i] = applyOp(op, values[i], operand);
+    }
+}
+
+static void addScalar(double *to, const double *from, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        to[i] += from[i];
+    }
+}
+
+static void prefixSumScalar(double *values, int count)
+{
+    double total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        total += values[i];
+        values[i] = total;
+    }
+}
+
+#endif
+
+double simdSum(const double *values, int count)
+{
+    return KERNEL(sum, values, count);
+}
+
+double simdDot(const double *a, const double *b, int count)
+{
+    return KERNEL(dot, a, b, count);
+}
+
+// min and max need at least one element.
+double simdMin(const double *values, int count)
+{
+    return KERNEL(min, values, count);
+}
+
+double simdMax(const double *values, int count)
+{
+    return KERNEL(max, values, count);
+}
+
+void simdMap(double *values, int count, SimdOp op, double operand)
+{
+    KERNEL(map, values, count, op, operand);
+}
+
+void simdAdd(double *to, const double *from, int count)
+{
+    KERNEL(add, to, from, count);
+}
+
+void simdPrefixSum(double *values, int count)
+{
+    KERNEL(prefixSum, values, count);
+}
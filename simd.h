@@ -0,0 +1,30 @@
+#ifndef clox_simd_h
+#define clox_simd_h
+
+#include "common.h"
+
+// Bulk kernels over contiguous doubles. On x86 they are written with
+// SSE2, which every x86-64 CPU has, and switch to AVX2 versions when the
+// CPU running them supports it. Elsewhere they are plain loops. Inputs
+// are expected to be FLOAT64_ARRAY_ALIGNMENT aligned.
+//
+// Reductions keep several partial results in vector lanes, so a sum may
+// round differently than adding the elements one by one.
+
+typedef enum
+{
+    SIMD_ADD,
+    SIMD_SUBTRACT,
+    SIMD_MULTIPLY,
+    SIMD_DIVIDE,
+} SimdOp;
+
+double simdSum(const double *values, int count);
+double simdDot(const double *a, const double *b, int count);
+double simdMin(const double *values, int count);
+double simdMax(const double *values, int count);
+void simdMap(double *values, int count, SimdOp op, double operand);
+void simdAdd(double *to, const double *from, int count);
+void simdPrefixSum(double *values, int count);
+
+#endif
@@ -0,0 +1,82 @@
+#include <sys/resource.h>
+
+#include "object.h"
+#include "stats.h"
+
+void initStats(VMStats *stats)
+{
+    stats->timeScanning = false;
+    stats->scanNs = 0;
+    stats->scannedBytes = 0;
+    stats->compileNs = 0;
+    stats->verifyNs = 0;
+    stats->runNs = 0;
+    stats->tokens = 0;
+    stats->sourceBytes = 0;
+    stats->instructions = 0;
+    stats->codeBytes = 0;
+    stats->constants = 0;
+    stats->strings = 0;
+    stats->heapBytes = 0;
+    stats->peakHeapBytes = 0;
+}
+
+// Adds the code and constants of a freshly compiled chunk and of the
+// functions it declares.
+void statsChunk(VMStats *stats, Chunk *chunk)
+{
+    stats->codeBytes += chunk->count;
+    stats->constants += chunk->constants.count;
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        if (IS_FUNCTION(chunk->constants.values[i]))
+        {
+            statsChunk(stats, &AS_FUNCTION(chunk->constants.values[i])->chunk);
+        }
+    }
+}
+
+static double perSecond(uint64_t count, uint64_t ns)
+{
+    return ns == 0 ? 0 : (double)count * 1e9 / (double)ns;
+}
+
+void reportStats(VMStats *stats, FILE *file)
+{
+    fprintf(file, "== stats ==\n");
+    if (stats->scannedBytes > 0)
+    {
+        fprintf(file, "%-14s %.3f ms, %llu bytes, %.1f MB/s\n", "scan", stats->scanNs / 1e6,
+                (unsigned long long)stats->scannedBytes,
+                perSecond(stats->scannedBytes, stats->scanNs) / 1e6);
+    }
+    else
+    {
+        fprintf(file, "%-14s not timed\n", "scan");
+    }
+    fprintf(file, "%-14s %.3f ms, %llu tokens, %.1f M tokens/s, %llu bytes, %.1f MB/s\n", "compile",
+            stats->compileNs / 1e6, (unsigned long long)stats->tokens,
+            perSecond(stats->tokens, stats->compileNs) / 1e6, (unsigned long long)stats->sourceBytes,
+            perSecond(stats->sourceBytes, stats->compileNs) / 1e6);
+    fprintf(file, "%-14s %.3f ms\n", "verify", stats->verifyNs / 1e6);
+    fprintf(file, "%-14s %.3f ms, %llu instructions, %.1f M instructions/s\n", "run",
+            stats->runNs / 1e6, (unsigned long long)stats->instructions,
+            perSecond(stats->instructions, stats->runNs) / 1e6);
+    fprintf(file, "%-14s %llu bytes, %llu constants\n", "code",
+            (unsigned long long)stats->codeBytes, (unsigned long long)stats->constants);
+    fprintf(file, "%-14s %llu interned\n", "strings", (unsigned long long)stats->strings);
+    fprintf(file, "%-14s %.1f KB peak\n", "heap", stats->peakHeapBytes / 1024.0);
+}
+
+// One line of key=value pairs for bench/run.sh.
+void reportBenchStats(VMStats *stats, FILE *file)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(file,
+            "compile_ms=%.3f verify_ms=%.3f run_ms=%.3f instructions=%llu peak_rss_kb=%ld "
+            "scan_ms=%.3f tokens=%llu peak_heap_kb=%zu\n",
+            stats->compileNs / 1e6, stats->verifyNs / 1e6, stats->runNs / 1e6,
+            (unsigned long long)stats->instructions, usage.ru_maxrss, stats->scanNs / 1e6,
+            (unsigned long long)stats->tokens, stats->peakHeapBytes / 1024);
+}
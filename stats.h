@@ -0,0 +1,58 @@
+#ifndef clox_stats_h
+#define clox_stats_h
+
+#include <stdio.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "common.h"
+
+// Totals for one VM since initVM(), kept up to date whether or not they
+// are reported. Times are in nanoseconds. Embedders read them with
+// getStats().
+typedef struct
+{
+    // Scanning is interleaved with parsing and too fine-grained to time
+    // token by token. With timeScanning set, compile() scans an in-memory
+    // source once more by itself first and times that; streams cannot be
+    // read twice and are not timed.
+    bool timeScanning;
+    uint64_t scanNs;
+    uint64_t scannedBytes;
+    uint64_t compileNs; // Scanning included, the extra pass not.
+    uint64_t verifyNs;
+    uint64_t runNs;
+    uint64_t tokens;
+    uint64_t sourceBytes;
+    uint64_t instructions;
+    // Bytecode and constants compiled, functions included.
+    uint64_t codeBytes;
+    uint64_t constants;
+    uint64_t strings; // Interned, filled in by getStats().
+    // Live and peak bytes allocated through reallocate().
+    size_t heapBytes;
+    size_t peakHeapBytes;
+} VMStats;
+
+static inline uint64_t statsNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static inline void statsAllocate(VMStats *stats, size_t oldSize, size_t newSize)
+{
+    stats->heapBytes += newSize - oldSize;
+    if (stats->heapBytes > stats->peakHeapBytes)
+    {
+        stats->peakHeapBytes = stats->heapBytes;
+    }
+}
+
+void initStats(VMStats *stats);
+void statsChunk(VMStats *stats, Chunk *chunk);
+void reportStats(VMStats *stats, FILE *file);
+void reportBenchStats(VMStats *stats, FILE *file);
+
+#endif
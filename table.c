@@ -15,9 +15,9 @@ void initTable(Table *table)
     table->entries = NULL;
 }
 
-void freeTable(Table *table)
+void freeTable(VM *vm, Table *table)
 {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(vm, Entry, table->entries, table->capacity);
     initTable(table);
 }
 
@@ -65,9 +65,9 @@ bool tableGet(Table *table, Value key, Value *value)
     return true;
 }
 
-static void adjustCapacity(Table *table, int capacity)
+static void adjustCapacity(VM *vm, Table *table, int capacity)
 {
-    Entry *entries = ALLOCATE(Entry, capacity);
+    Entry *entries = ALLOCATE(vm, Entry, capacity);
     for (int i = 0; i < capacity; i++)
     {
         entries[i].key = EMPTY_VAL;
@@ -87,18 +87,18 @@ static void adjustCapacity(Table *table, int capacity)
         dest->value = entry->value;
         table->count++;
     }
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(vm, Entry, table->entries, table->capacity);
 
     table->entries = entries;
     table->capacity = capacity;
 }
 
-bool tableSet(Table *table, Value key, Value value)
+bool tableSet(VM *vm, Table *table, Value key, Value value)
 {
     if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
     {
         int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+        adjustCapacity(vm, table, capacity);
     }
     Entry *entry = findEntry(table->entries, table->capacity, key);
 
@@ -130,14 +130,14 @@ bool tableDelete(Table *table, Value key)
     return true;
 }
 
-void tableAddAll(Table *from, Table *to)
+void tableAddAll(VM *vm, Table *from, Table *to)
 {
     for (size_t i = 0; i < from->capacity; i++)
     {
         Entry *entry = &from->entries[i];
         if (!IS_EMPTY(entry->key))
         {
-            tableSet(to, entry->key, entry->value);
+            tableSet(vm, to, entry->key, entry->value);
         }
     }
 }
@@ -165,4 +165,45 @@ ObjString *tableFindString(Table *table, const char *chars, int length, uint32_t
         }
         index = (index + 1) % table->capacity;
     }
-}
\ No newline at end of file
+}
+
+// Finds the interned string equal to the strings in parts joined together
+// without building it.
+ObjString *tableFindConcatenation(Table *table, Value *parts, int count, int length, uint32_t hash)
+{
+    if (table->count == 0)
+    {
+        return NULL;
+    }
+    uint32_t index = hash % table->capacity;
+
+    for (;;)
+    {
+        Entry *entry = &table->entries[index];
+
+        if (IS_EMPTY(entry->key))
+        {
+            return NULL;
+        }
+        ObjString *string = AS_STRING(entry->key);
+        if (string->hash == hash && string->length == length)
+        {
+            int offset = 0;
+            int part = 0;
+            for (; part < count; part++)
+            {
+                ObjString *chars = AS_STRING(parts[part]);
+                if (memcmp(string->chars + offset, chars->chars, chars->length) != 0)
+                {
+                    break;
+                }
+                offset += chars->length;
+            }
+            if (part == count)
+            {
+                return string;
+            }
+        }
+        index = (index + 1) % table->capacity;
+    }
+}
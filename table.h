@@ -18,11 +18,12 @@ typedef struct
 } Table;
 
 void initTable(Table *table);
-void freeTable(Table *table);
+void freeTable(VM *vm, Table *table);
 bool tableGet(Table *table, Value key, Value *value);
-bool tableSet(Table *table, Value key, Value value);
+bool tableSet(VM *vm, Table *table, Value key, Value value);
 bool tableDelete(Table *table, Value key);
-void tableAddAll(Table *from, Table *to);
+void tableAddAll(VM *vm, Table *from, Table *to);
 ObjString* tableFindString(Table *table, const char *chars, int length, uint32_t hash);
+ObjString *tableFindConcatenation(Table *table, Value *parts, int count, int length, uint32_t hash);
 
 #endif
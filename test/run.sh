@@ -0,0 +1,48 @@
+#!/bin/sh
+# Usage: test/run.sh <cLox binary>
+#
+# Runs every script under test/ and compares what it prints with the
+# "// expect: " comments in it. A script with an "// expect runtime
+# error: " or "// expect compile error: " comment must instead exit with
+# 70 or 65 and report that message; any other script must exit with 0.
+BIN=$1
+DIR=$(dirname "$0")
+
+if [ -z "$BIN" ]; then
+    echo "Usage: $0 <cLox binary>" >&2
+    exit 64
+fi
+
+errors=$(mktemp)
+trap 'rm -f "$errors"' EXIT
+
+passed=0
+failed=0
+for script in "$DIR"/*/*.lox; do
+    [ -f "$script" ] || continue
+    expected=$(sed -n 's|.*// expect: ||p' "$script")
+    runtimeError=$(sed -n 's|.*// expect runtime error: ||p' "$script")
+    compileError=$(sed -n 's|.*// expect compile error: ||p' "$script")
+    actual=$("$BIN" "$script" 2>"$errors")
+    status=$?
+
+    ok=true
+    [ "$actual" = "$expected" ] || ok=false
+    if [ -n "$runtimeError" ]; then
+        [ "$status" -eq 70 ] && [ "$(head -n 1 "$errors")" = "$runtimeError" ] || ok=false
+    elif [ -n "$compileError" ]; then
+        [ "$status" -eq 65 ] && grep -qF -- "$compileError" "$errors" || ok=false
+    else
+        [ "$status" -eq 0 ] || ok=false
+    fi
+
+    if $ok; then
+        passed=$((passed + 1))
+    else
+        failed=$((failed + 1))
+        echo "FAIL $script (exit $status)"
+        { echo "$actual"; head -n 5 "$errors"; } | sed 's/^/    /'
+    fi
+done
+echo "scripts: $passed passed, $failed failed"
+[ "$failed" -eq 0 ]
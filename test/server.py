@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+# Usage: test/server.py <cLox binary>
+#
+# Starts the binary with --serve, with and without --cache, and checks
+# that the natives initVM() defines survive from one request to the next
+# and are there in every 'E' session.
+import os
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def request(connection, kind, source):
+    payload = source.encode()
+    connection.sendall(kind.encode() + struct.pack(">I", len(payload)) + payload)
+
+    def read(count):
+        data = b""
+        while len(data) < count:
+            chunk = connection.recv(count - len(data))
+            if not chunk:
+                raise EOFError("server hung up")
+            data += chunk
+        return data
+
+    status = read(1)[0]
+    output = read(struct.unpack(">I", read(4))[0]).decode()
+    errors = read(struct.unpack(">I", read(4))[0]).decode()
+    return status, output, errors
+
+
+def connect(path):
+    for _ in range(100):
+        try:
+            connection = socket.socket(socket.AF_UNIX)
+            connection.connect(path)
+            return connection
+        except OSError:
+            connection.close()
+            time.sleep(0.02)
+    raise RuntimeError("server did not come up")
+
+
+def expect(name, got, wanted):
+    if got != wanted:
+        print("FAIL %s: got %r, expected %r" % (name, got, wanted))
+        return 1
+    return 0
+
+
+def run(binary, flags):
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, "socket")
+        server = subprocess.Popen([binary, "--serve", path] + flags)
+        try:
+            connection = connect(path)
+            script = "var a = Float64Array(3); arrayFill(a, 2); print arrayLength(a); print arraySum(a);"
+            for i in range(2):
+                failures += expect("script %d %s" % (i, flags), request(connection, "S", script),
+                                   (0, "3\n6\n", ""))
+            failures += expect("session %s" % flags,
+                               request(connection, "E", "var b = Float64Array(2);"), (0, "", ""))
+            failures += expect("session %s" % flags,
+                               request(connection, "E", "print arrayLength(b);"), (0, "2\n", ""))
+            connection.close()
+
+            # A new connection starts a new session with the natives in it.
+            connection = connect(path)
+            failures += expect("second session %s" % flags,
+                               request(connection, "E", "print arrayLength(Float64Array(4));"),
+                               (0, "4\n", ""))
+            connection.close()
+        finally:
+            server.terminate()
+            server.wait()
+    return failures
+
+
+def main():
+    if len(sys.argv) != 2:
+        print("Usage: %s <cLox binary>" % sys.argv[0], file=sys.stderr)
+        return 64
+    failures = run(sys.argv[1], []) + run(sys.argv[1], ["--cache"])
+    print("server: %s" % ("ok" if failures == 0 else "%d failed" % failures))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,4 +1,6 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "memory.h"
@@ -25,6 +27,10 @@ uint32_t hashValue(Value value)
         return 2;
     case VAL_NUMBER:
         return hashDouble(AS_NUMBER(value));
+    case VAL_INT:
+        // An integer equal to a double converts to it exactly, so both
+        // hash alike.
+        return hashDouble((double)AS_INT(value));
     case VAL_OBJ:
         return AS_STRING(value)->hash;
     case VAL_EMPTY:
@@ -40,13 +46,13 @@ void initValueArray(ValueArray *array)
     array->count = 0;
 }
 
-void writeValueArray(ValueArray *array, Value value)
+void writeValueArray(VM *vm, ValueArray *array, Value value)
 {
     if (array->capacity < array->count + 1)
     {
         int oldCapacity = array->capacity;
         array->capacity = GROW_CAPACITY(oldCapacity);
-        array->values = GROW_ARRAY(array->values, Value,
+        array->values = GROW_ARRAY(vm, array->values, Value,
                                    oldCapacity, array->capacity);
     }
 
@@ -54,38 +60,326 @@ void writeValueArray(ValueArray *array, Value value)
     array->count++;
 }
 
-void freeValueArray(ValueArray *array)
+void freeValueArray(VM *vm, ValueArray *array)
 {
-    FREE_ARRAY(Value, array->values, array->capacity);
+    FREE_ARRAY(vm, Value, array->values, array->capacity);
     initValueArray(array);
 }
 
+static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+#define MAX_EXACT_POWER 22
+
+static int writeDigits(char *buffer, uint32_t value, int count)
+{
+    for (int i = count - 1; i >= 0; i--)
+    {
+        buffer[i] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    return count;
+}
+
+static int writeInteger(char *buffer, uint32_t value)
+{
+    int count = 1;
+    for (uint32_t rest = value / 10; rest != 0; rest /= 10)
+    {
+        count++;
+    }
+    return writeDigits(buffer, value, count);
+}
+
+// Scales magnitude so that it has six digits before the point when
+// its decimal exponent is exponent. Each scale is one correctly rounded
+// operation with an exact power of ten.
+static double scaleToSixDigits(double magnitude, int exponent)
+{
+    int shift = 5 - exponent;
+    return shift >= 0 ? magnitude * powersOfTen[shift] : magnitude / powersOfTen[-shift];
+}
+
+// Rounds magnitude to six significant digits the way printf does and
+// returns them with the decimal exponent. Returns false when the scaled
+// value is too close to a rounding tie to decide without exact
+// arithmetic, or out of the range of exact powers of ten.
+static bool roundToSixDigits(double magnitude, uint32_t *digits, int *exponent)
+{
+    int guess = 0;
+    if (magnitude >= 1)
+    {
+        while (guess < MAX_EXACT_POWER && magnitude >= powersOfTen[guess + 1])
+        {
+            guess++;
+        }
+    }
+    else
+    {
+        while (guess > 5 - MAX_EXACT_POWER && magnitude * powersOfTen[-guess] < 1)
+        {
+            guess--;
+        }
+    }
+    if (guess - 5 > MAX_EXACT_POWER || 5 - guess > MAX_EXACT_POWER)
+    {
+        return false;
+    }
+
+    double scaled = scaleToSixDigits(magnitude, guess);
+    if (scaled < 99999.5 && 6 - guess <= MAX_EXACT_POWER)
+    {
+        guess--;
+        scaled = scaleToSixDigits(magnitude, guess);
+    }
+    if (scaled < 99999.5 || scaled >= 1000000)
+    {
+        return false;
+    }
+
+    // The scaled value carries at most half an ulp of error, about 1e-10
+    // at this size, so only a fraction very close to one half is unsafe.
+    uint32_t whole = (uint32_t)scaled;
+    double fraction = scaled - (double)whole;
+    if (fraction > 0.5 - 1e-7 && fraction < 0.5 + 1e-7)
+    {
+        return false;
+    }
+    *digits = whole + (fraction > 0.5 ? 1 : 0);
+    if (*digits == 1000000)
+    {
+        *digits = 100000;
+        guess++;
+    }
+    *exponent = guess;
+    return true;
+}
+
+// Writes number exactly as printf("%g") would: six significant digits,
+// trailing zeros dropped, scientific notation below 1e-4 and from 1e6 up.
+// Whole numbers below a million and everything the six-digit rounding
+// can decide are formatted here; the rest falls back to snprintf().
+int formatNumber(double number, char *buffer)
+{
+    // The release build's -Ofast assumes there are no NaNs, infinities or
+    // negative zeros and folds isnan(), isinf() and signbit() away, so
+    // those are read from the IEEE bits instead.
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    if (((bits >> 52) & 0x7FF) == 0x7FF)
+    {
+        return snprintf(buffer, NUMBER_BUFFER_SIZE, "%g", number);
+    }
+
+    int length = 0;
+    double magnitude = number;
+    if (bits >> 63)
+    {
+        buffer[length++] = '-';
+        magnitude = -number;
+    }
+
+    if (magnitude < 1000000)
+    {
+        uint32_t whole = (uint32_t)magnitude;
+        if (!((double)whole < magnitude))
+        {
+            return length + writeInteger(buffer + length, whole);
+        }
+    }
+
+    uint32_t digits;
+    int exponent;
+    if (!roundToSixDigits(magnitude, &digits, &exponent))
+    {
+        return snprintf(buffer, NUMBER_BUFFER_SIZE, "%g", number);
+    }
+
+    int significant = 6;
+    while (digits % 10 == 0)
+    {
+        digits /= 10;
+        significant--;
+    }
+
+    if (exponent < -4 || exponent >= 6)
+    {
+        uint32_t lead = (uint32_t)powersOfTen[significant - 1];
+        buffer[length++] = (char)('0' + digits / lead);
+        if (significant > 1)
+        {
+            buffer[length++] = '.';
+            length += writeDigits(buffer + length, digits % lead, significant - 1);
+        }
+        buffer[length++] = 'e';
+        buffer[length++] = exponent < 0 ? '-' : '+';
+        int power = exponent < 0 ? -exponent : exponent;
+        return length + writeDigits(buffer + length, power, power >= 100 ? 3 : 2);
+    }
+
+    if (exponent < 0)
+    {
+        buffer[length++] = '0';
+        buffer[length++] = '.';
+        for (int i = exponent; i < -1; i++)
+        {
+            buffer[length++] = '0';
+        }
+        return length + writeDigits(buffer + length, digits, significant);
+    }
+
+    // The digits may have rounded to a whole number, e.g. 12345.96 to
+    // 12346, in which case there is no fraction to write.
+    int integral = exponent + 1;
+    if (significant <= integral)
+    {
+        length += writeDigits(buffer + length, digits, significant);
+        for (int i = significant; i < integral; i++)
+        {
+            buffer[length++] = '0';
+        }
+        return length;
+    }
+    uint32_t split = (uint32_t)powersOfTen[significant - integral];
+    length += writeDigits(buffer + length, digits / split, integral);
+    buffer[length++] = '.';
+    return length + writeDigits(buffer + length, digits % split, significant - integral);
+}
+
+// strtod() on a NUL-terminated copy, so that it cannot read past the token.
+static double parseNumberSlow(const char *chars, int length)
+{
+    char local[64];
+    char *copy = length < (int)sizeof(local) ? local : (char *)malloc(length + 1);
+    if (copy == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(74);
+    }
+    memcpy(copy, chars, length);
+    copy[length] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != local)
+    {
+        free(copy);
+    }
+    return value;
+}
+
+// Parses a literal without a fraction into an integer. Returns false if
+// there is a fraction or the value does not fit in 64 bits.
+bool parseInteger(const char *chars, int length, int64_t *integer)
+{
+    int64_t value = 0;
+    for (int i = 0; i < length; i++)
+    {
+        if (chars[i] == '.' ||
+            __builtin_mul_overflow(value, 10, &value) ||
+            __builtin_add_overflow(value, chars[i] - '0', &value))
+        {
+            return false;
+        }
+    }
+    *integer = value;
+    return true;
+}
+
+// Parses a literal as the scanner accepts it: digits with an optional
+// fraction. When the significant digits fit in 53 bits and there are at
+// most 22 fraction digits, both the mantissa and the power of ten are
+// exact, so one division gives the correctly rounded result, the same
+// one strtod() computes. Longer literals go to strtod().
+double parseNumber(const char *chars, int length)
+{
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int fraction = 0;
+    bool inFraction = false;
+    for (int i = 0; i < length; i++)
+    {
+        char c = chars[i];
+        if (c == '.')
+        {
+            inFraction = true;
+            continue;
+        }
+        if (significant == 19)
+        {
+            return parseNumberSlow(chars, length);
+        }
+        mantissa = mantissa * 10 + (uint64_t)(c - '0');
+        if (mantissa != 0)
+        {
+            significant++;
+        }
+        if (inFraction)
+        {
+            fraction++;
+        }
+    }
+
+    if (mantissa > ((uint64_t)1 << 53) || fraction > MAX_EXACT_POWER)
+    {
+        return parseNumberSlow(chars, length);
+    }
+    return (double)mantissa / powersOfTen[fraction];
+}
+
 void printValue(Value value)
+{
+    fprintValue(stdout, value);
+}
+
+void fprintValue(FILE *file, Value value)
 {
     switch (value.type)
     {
     case VAL_BOOL:
-        printf(AS_BOOL(value) ? "true" : "false");
+        fputs(AS_BOOL(value) ? "true" : "false", file);
         break;
     case VAL_NIL:
-        printf("nil");
+        fputs("nil", file);
         break;
     case VAL_NUMBER:
-        printf("%g", AS_NUMBER(value));
+    case VAL_INT:
+    {
+        char buffer[NUMBER_BUFFER_SIZE];
+        fwrite(buffer, 1, formatNumber(AS_DOUBLE(value), buffer), file);
         break;
+    }
     case VAL_OBJ:
-        printObject(value);
+        printObject(file, value);
         break;
     case VAL_EMPTY:
-        printf("[empty]");
+        fputs("[empty]", file);
         break;
     }
 }
 
+// True if the double is integral and has exactly the integer's value.
+static bool intEqualsDouble(int64_t integer, double number)
+{
+    if (!(number >= -9223372036854775808.0 && number < 9223372036854775808.0))
+    {
+        return false;
+    }
+    int64_t whole = (int64_t)number;
+    return whole == integer && !((double)whole < number || (double)whole > number);
+}
+
 bool valuesEqual(Value a, Value b)
 {
     if (a.type != b.type)
     {
+        if (IS_INT(a) && IS_NUMBER(b))
+        {
+            return intEqualsDouble(AS_INT(a), AS_NUMBER(b));
+        }
+        if (IS_NUMBER(a) && IS_INT(b))
+        {
+            return intEqualsDouble(AS_INT(b), AS_NUMBER(a));
+        }
         return false;
     }
 
@@ -97,6 +391,8 @@ bool valuesEqual(Value a, Value b)
         return true;
     case VAL_NUMBER:
         return AS_NUMBER(a) == AS_NUMBER(b);
+    case VAL_INT:
+        return AS_INT(a) == AS_INT(b);
     case VAL_OBJ:
     {
         return AS_OBJ(a) == AS_OBJ(b);
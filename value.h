@@ -1,6 +1,8 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include <stdio.h>
+
 #include "common.h"
 
 typedef struct sObj Obj;
@@ -11,6 +13,7 @@ typedef enum
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
+    VAL_INT,
     VAL_OBJ,
     VAL_EMPTY,
 } ValueType;
@@ -21,6 +24,7 @@ typedef struct
     union {
         bool boolean;
         double number;
+        int64_t integer;
         Obj *obj;
     } as;
 } Value;
@@ -28,19 +32,30 @@ typedef struct
 #define IS_BOOL(value)    ((value).type == VAL_BOOL)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
 #define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
+#define IS_INT(value)     ((value).type == VAL_INT)
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INT(value))
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
 #define IS_EMPTY(value)   ((value).type == VAL_EMPTY)
 
 #define AS_BOOL(value)    ((value).as.boolean)
 #define AS_NUMBER(value)  ((value).as.number)
+#define AS_INT(value)     ((value).as.integer)
+#define AS_DOUBLE(value)  numericToDouble(value)
 #define AS_OBJ(value)     ((value).as.obj)
 
 #define BOOL_VAL(value)   ((Value){ VAL_BOOL, { .boolean = value } })
 #define NIL_VAL           ((Value){ VAL_NIL, { .number = 0 } })
 #define EMPTY_VAL         ((Value){ VAL_EMPTY, { .number = 0 } })
 #define NUMBER_VAL(value) ((Value){ VAL_NUMBER, { .number = value } })
+#define INT_VAL(value)    ((Value){ VAL_INT, { .integer = value } })
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj *)object}})
 
+// AS_DOUBLE() is a function so that its argument is evaluated once.
+static inline double numericToDouble(Value value)
+{
+    return IS_INT(value) ? (double)AS_INT(value) : AS_NUMBER(value);
+}
+
 typedef struct
 {
     int capacity;
@@ -48,10 +63,17 @@ typedef struct
     Value *values;
 } ValueArray;
 
+// Large enough for any %g rendering of a double.
+#define NUMBER_BUFFER_SIZE 32
+
 void initValueArray(ValueArray *array);
-void writeValueArray(ValueArray *array, Value value);
-void freeValueArray(ValueArray *array);
+void writeValueArray(VM *vm, ValueArray *array, Value value);
+void freeValueArray(VM *vm, ValueArray *array);
+int formatNumber(double number, char *buffer);
+double parseNumber(const char *chars, int length);
+bool parseInteger(const char *chars, int length, int64_t *integer);
 void printValue(Value value);
+void fprintValue(FILE *file, Value value);
 bool valuesEqual(Value a, Value b);
 
 #endif
\ No newline at end of file
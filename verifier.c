@@ -0,0 +1,597 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef DEBUG_PRINT_CODE
+#include <time.h>
+#endif
+
+#include "debug.h"
+#include "memory.h"
+#include "object.h"
+#include "verifier.h"
+#include "vm.h"
+
+typedef enum
+{
+    OPERAND_NONE,
+    OPERAND_CONSTANT,
+    OPERAND_CONSTANT_LONG,
+    OPERAND_NAME,
+    OPERAND_NAME_LONG,
+    OPERAND_CONSTANT_WIDE,
+    OPERAND_NAME_WIDE,
+    OPERAND_COUNT,
+    OPERAND_ARGS,
+    OPERAND_SLOT,
+    OPERAND_SLOT_LONG,
+    OPERAND_JUMP, // Forward.
+    OPERAND_LOOP, // Backward.
+} OperandKind;
+
+// What is proven about the value an instruction pushes.
+typedef enum
+{
+    RESULT_ANY,
+    RESULT_NUMBER,
+    RESULT_OPERANDS, // A number when anything it popped was one.
+    RESULT_CONSTANT, // A number when its constant is one.
+    RESULT_SLOT,     // A number when its local slot holds one.
+} ResultKind;
+
+typedef struct
+{
+    bool known;
+    OperandKind operand;
+    int pops;
+    int pushes;
+    ResultKind result;
+    bool needsNumbers; // Unchecked, every operand must be proven numeric.
+} OpcodeShape;
+
+static const OpcodeShape shapes[OPCODE_COUNT] = {
+    [OP_CONSTANT] = {true, OPERAND_CONSTANT, 0, 1, RESULT_CONSTANT, false},
+    [OP_CONSTANT_LONG] = {true, OPERAND_CONSTANT_LONG, 0, 1, RESULT_CONSTANT, false},
+    [OP_NIL] = {true, OPERAND_NONE, 0, 1, RESULT_ANY, false},
+    [OP_TRUE] = {true, OPERAND_NONE, 0, 1, RESULT_ANY, false},
+    [OP_FALSE] = {true, OPERAND_NONE, 0, 1, RESULT_ANY, false},
+    [OP_EQUAL] = {true, OPERAND_NONE, 2, 1, RESULT_ANY, false},
+    [OP_GREATER] = {true, OPERAND_NONE, 2, 1, RESULT_ANY, false},
+    [OP_LESS] = {true, OPERAND_NONE, 2, 1, RESULT_ANY, false},
+    [OP_ADD] = {true, OPERAND_NONE, 2, 1, RESULT_OPERANDS, false},
+    [OP_SUBTRACT] = {true, OPERAND_NONE, 2, 1, RESULT_NUMBER, false},
+    [OP_MULTIPLY] = {true, OPERAND_NONE, 2, 1, RESULT_NUMBER, false},
+    [OP_DIVIDE] = {true, OPERAND_NONE, 2, 1, RESULT_NUMBER, false},
+    [OP_NOT] = {true, OPERAND_NONE, 1, 1, RESULT_ANY, false},
+    [OP_NEGATE] = {true, OPERAND_NONE, 1, 1, RESULT_NUMBER, false},
+    [OP_PRINT] = {true, OPERAND_NONE, 1, 0, RESULT_ANY, false},
+    [OP_POP] = {true, OPERAND_NONE, 1, 0, RESULT_ANY, false},
+    [OP_DEFINE_GLOBAL] = {true, OPERAND_NAME, 1, 0, RESULT_ANY, false},
+    [OP_DEFINE_GLOBAL_LONG] = {true, OPERAND_NAME_LONG, 1, 0, RESULT_ANY, false},
+    [OP_GET_GLOBAL] = {true, OPERAND_NAME, 0, 1, RESULT_ANY, false},
+    [OP_GET_GLOBAL_LONG] = {true, OPERAND_NAME_LONG, 0, 1, RESULT_ANY, false},
+    [OP_SET_GLOBAL] = {true, OPERAND_NAME, 1, 1, RESULT_OPERANDS, false},
+    [OP_SET_GLOBAL_LONG] = {true, OPERAND_NAME_LONG, 1, 1, RESULT_OPERANDS, false},
+    // Pops as many values as its operand says.
+    [OP_CONCAT_N] = {true, OPERAND_COUNT, 0, 1, RESULT_OPERANDS, false},
+    [OP_ADD_NN] = {true, OPERAND_NONE, 2, 1, RESULT_NUMBER, true},
+    [OP_SUBTRACT_NN] = {true, OPERAND_NONE, 2, 1, RESULT_NUMBER, true},
+    [OP_MULTIPLY_NN] = {true, OPERAND_NONE, 2, 1, RESULT_NUMBER, true},
+    [OP_DIVIDE_NN] = {true, OPERAND_NONE, 2, 1, RESULT_NUMBER, true},
+    [OP_LESS_NN] = {true, OPERAND_NONE, 2, 1, RESULT_ANY, true},
+    [OP_GREATER_NN] = {true, OPERAND_NONE, 2, 1, RESULT_ANY, true},
+    [OP_GET_LOCAL] = {true, OPERAND_SLOT, 0, 1, RESULT_SLOT, false},
+    [OP_GET_LOCAL_LONG] = {true, OPERAND_SLOT_LONG, 0, 1, RESULT_SLOT, false},
+    [OP_SET_LOCAL] = {true, OPERAND_SLOT, 1, 1, RESULT_OPERANDS, false},
+    [OP_SET_LOCAL_LONG] = {true, OPERAND_SLOT_LONG, 1, 1, RESULT_OPERANDS, false},
+    // Pops as many values as its operand says.
+    [OP_POPN] = {true, OPERAND_COUNT, 0, 0, RESULT_ANY, false},
+    [OP_JUMP] = {true, OPERAND_JUMP, 0, 0, RESULT_ANY, false},
+    [OP_JUMP_IF_FALSE] = {true, OPERAND_JUMP, 0, 0, RESULT_ANY, false},
+    [OP_POP_JUMP_IF_FALSE] = {true, OPERAND_JUMP, 1, 0, RESULT_ANY, false},
+    [OP_LOOP] = {true, OPERAND_LOOP, 0, 0, RESULT_ANY, false},
+    [OP_JUMP_IF_NOT_LESS] = {true, OPERAND_JUMP, 2, 0, RESULT_ANY, false},
+    [OP_JUMP_IF_NOT_GREATER] = {true, OPERAND_JUMP, 2, 0, RESULT_ANY, false},
+    [OP_JUMP_IF_LESS] = {true, OPERAND_JUMP, 2, 0, RESULT_ANY, false},
+    [OP_JUMP_IF_GREATER] = {true, OPERAND_JUMP, 2, 0, RESULT_ANY, false},
+    [OP_JUMP_IF_NOT_EQUAL] = {true, OPERAND_JUMP, 2, 0, RESULT_ANY, false},
+    [OP_JUMP_IF_EQUAL] = {true, OPERAND_JUMP, 2, 0, RESULT_ANY, false},
+    // Pop the callee and as many arguments as the operand says.
+    [OP_CALL] = {true, OPERAND_ARGS, 1, 1, RESULT_ANY, false},
+    [OP_TAIL_CALL] = {true, OPERAND_ARGS, 1, 1, RESULT_ANY, false},
+    [OP_RETURN] = {true, OPERAND_NONE, 1, 0, RESULT_ANY, false},
+};
+
+static bool invalid(VM *vm, Chunk *chunk, int offset, const char *format, ...)
+{
+    fprintf(vm->errors, "[line %d] Invalid bytecode at offset %d: ",
+            chunk->count > 0 ? getLine(chunk, offset < chunk->count ? offset : chunk->count - 1) : 0,
+            offset);
+    va_list args;
+    va_start(args, format);
+    vfprintf(vm->errors, format, args);
+    va_end(args);
+    fputs("\n", vm->errors);
+    return false;
+}
+
+static int operandLength(OperandKind kind)
+{
+    switch (kind)
+    {
+    case OPERAND_NONE:
+        return 0;
+    case OPERAND_CONSTANT:
+    case OPERAND_NAME:
+    case OPERAND_COUNT:
+    case OPERAND_ARGS:
+    case OPERAND_SLOT:
+        return 1;
+    case OPERAND_CONSTANT_LONG:
+    case OPERAND_NAME_LONG:
+    case OPERAND_SLOT_LONG:
+    case OPERAND_JUMP:
+    case OPERAND_LOOP:
+        return 2;
+    case OPERAND_CONSTANT_WIDE:
+    case OPERAND_NAME_WIDE:
+        return 3;
+    }
+    return 0;
+}
+
+static int readShort(Chunk *chunk, int offset)
+{
+    return chunk->code[offset] | (chunk->code[offset + 1] << 8);
+}
+
+// Reads a little-endian operand of length bytes starting at offset.
+static int readOperand(Chunk *chunk, int offset, int length)
+{
+    int operand = 0;
+    for (int i = length - 1; i >= 0; i--)
+    {
+        operand = (operand << 8) | chunk->code[offset + i];
+    }
+    return operand;
+}
+
+// Returns the opcode of the instruction at offset, looking through an
+// OP_WIDE prefix, and where its operand starts. The operand kind of a
+// prefixed instruction is OPERAND_NONE when it cannot be widened.
+static uint8_t decode(Chunk *chunk, int offset, int *operand, OperandKind *kind)
+{
+    uint8_t opcode = chunk->code[offset];
+    *operand = offset + 1;
+    *kind = opcode < OPCODE_COUNT ? shapes[opcode].operand : OPERAND_NONE;
+    if (opcode != OP_WIDE || offset + 1 >= chunk->count)
+    {
+        return opcode;
+    }
+    opcode = chunk->code[offset + 1];
+    *operand = offset + 2;
+    *kind = OPERAND_NONE;
+    if (opcode == OP_CONSTANT)
+    {
+        *kind = OPERAND_CONSTANT_WIDE;
+    }
+    else if (opcode < OPCODE_COUNT && shapes[opcode].operand == OPERAND_NAME)
+    {
+        *kind = OPERAND_NAME_WIDE;
+    }
+    return opcode;
+}
+
+// Where the jump at offset lands.
+static int jumpTarget(Chunk *chunk, int offset, OperandKind kind)
+{
+    int distance = readShort(chunk, offset + 1);
+    return kind == OPERAND_LOOP ? offset + 3 - distance : offset + 3 + distance;
+}
+
+// Checks the operand of the instruction at offset, which starts at
+// operand, and returns its length.
+static int checkOperand(VM *vm, Chunk *chunk, int offset, uint8_t opcode, int operand,
+                        OperandKind kind)
+{
+    int length = operandLength(kind);
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    if (operand + length > chunk->count)
+    {
+        invalid(vm, chunk, offset, "truncated operand of %s.", opcodeName(opcode));
+        return -1;
+    }
+    if (kind == OPERAND_COUNT)
+    {
+        if (chunk->code[operand] < 2)
+        {
+            invalid(vm, chunk, offset, "%s needs a count of at least two.", opcodeName(opcode));
+            return -1;
+        }
+        return length;
+    }
+    if (kind == OPERAND_ARGS || kind == OPERAND_SLOT || kind == OPERAND_SLOT_LONG ||
+        kind == OPERAND_JUMP || kind == OPERAND_LOOP)
+    {
+        // Checked against the stack and the jump targets by the caller.
+        return length;
+    }
+
+    int index = readOperand(chunk, operand, length);
+    if (index >= chunk->constants.count)
+    {
+        invalid(vm, chunk, offset, "constant %d out of range, the pool has %d.",
+                index, chunk->constants.count);
+        return -1;
+    }
+    if ((kind == OPERAND_NAME || kind == OPERAND_NAME_LONG || kind == OPERAND_NAME_WIDE) &&
+        !IS_STRING(chunk->constants.values[index]))
+    {
+        invalid(vm, chunk, offset, "%s needs a string constant.", opcodeName(opcode));
+        return -1;
+    }
+    return length;
+}
+
+#define AT_INSTRUCTION 0x1
+#define AT_TARGET 0x2
+#define AT_LOOP_HEADER 0x4
+
+// What is known on entry to a jump target: the stack depth and which
+// slots hold numbers, merged over every jump seen so far.
+typedef struct
+{
+    uint8_t *flags;
+    int *depth;
+    int *snapshot;
+    bool *numeric;
+    int numericCount;
+    int numericCapacity;
+} Entries;
+
+static void freeEntries(VM *vm, Chunk *chunk, Entries *entries)
+{
+    FREE_ARRAY(vm, uint8_t, entries->flags, chunk->count);
+    FREE_ARRAY(vm, int, entries->depth, chunk->count);
+    FREE_ARRAY(vm, int, entries->snapshot, chunk->count);
+    FREE_ARRAY(vm, bool, entries->numeric, entries->numericCapacity);
+}
+
+// Decodes every instruction once to check opcodes and operands and to
+// find the jump targets before the stack is simulated.
+static bool findTargets(VM *vm, Chunk *chunk, Entries *entries)
+{
+    int offset = 0;
+    while (offset < chunk->count)
+    {
+        int operand;
+        OperandKind kind;
+        uint8_t opcode = decode(chunk, offset, &operand, &kind);
+        if (chunk->code[offset] == OP_WIDE && (operand == offset + 1 || kind == OPERAND_NONE))
+        {
+            return invalid(vm, chunk, offset,
+                           "OP_WIDE must prefix OP_CONSTANT or a global instruction.");
+        }
+        if (opcode >= OPCODE_COUNT || !shapes[opcode].known)
+        {
+            return invalid(vm, chunk, offset, "unknown opcode %d.", opcode);
+        }
+        int length = checkOperand(vm, chunk, offset, opcode, operand, kind);
+        if (length < 0)
+        {
+            return false;
+        }
+        entries->flags[offset] |= AT_INSTRUCTION;
+        if (kind == OPERAND_JUMP || kind == OPERAND_LOOP)
+        {
+            int target = jumpTarget(chunk, offset, kind);
+            if (target < 0 || target >= chunk->count)
+            {
+                return invalid(vm, chunk, offset, "jump to %d leaves the chunk.", target);
+            }
+            if ((kind == OPERAND_LOOP) != (target <= offset))
+            {
+                return invalid(vm, chunk, offset, "%s to %d goes the wrong way.",
+                               opcodeName(opcode), target);
+            }
+            entries->flags[target] |= kind == OPERAND_LOOP ? AT_LOOP_HEADER : AT_TARGET;
+        }
+        offset = operand + length;
+    }
+    return true;
+}
+
+// Records the state flowing along a forward jump into its target.
+static bool recordJump(VM *vm, Chunk *chunk, Entries *entries, int offset, int target,
+                       int depth, bool *numeric)
+{
+    if (entries->depth[target] == -1)
+    {
+        if (entries->numericCount + depth > entries->numericCapacity)
+        {
+            int oldCapacity = entries->numericCapacity;
+            while (entries->numericCount + depth > entries->numericCapacity)
+            {
+                entries->numericCapacity = GROW_CAPACITY(entries->numericCapacity);
+            }
+            entries->numeric = GROW_ARRAY(vm, entries->numeric, bool, oldCapacity,
+                                          entries->numericCapacity);
+        }
+        entries->depth[target] = depth;
+        entries->snapshot[target] = entries->numericCount;
+        if (depth > 0)
+        {
+            memcpy(&entries->numeric[entries->numericCount], numeric, depth * sizeof(bool));
+            entries->numericCount += depth;
+        }
+        return true;
+    }
+    if (entries->depth[target] != depth)
+    {
+        return invalid(vm, chunk, offset, "jump to %d with %d values, %d expected there.",
+                       target, depth, entries->depth[target]);
+    }
+    bool *snapshot = entries->numeric + entries->snapshot[target];
+    for (int i = 0; i < depth; i++)
+    {
+        snapshot[i] = snapshot[i] && numeric[i];
+    }
+    return true;
+}
+
+// Simulates the stack once, in code order. Forward jumps carry their
+// state to the target. Loop headers drop every numeric proof, so the back
+// edges only need to agree on the depth and no fixpoint is needed.
+static bool simulate(VM *vm, Chunk *chunk, Entries *entries, int base)
+{
+    // Whether each stack slot is proven to hold an int or a double.
+    bool numeric[STACK_MAX];
+    bool reachable = true;
+    int depth = base;
+    int maxDepth = base;
+    for (int i = 0; i < base; i++)
+    {
+        numeric[i] = false;
+    }
+    int offset = 0;
+    while (offset < chunk->count)
+    {
+        int operand;
+        OperandKind kind;
+        uint8_t opcode = decode(chunk, offset, &operand, &kind);
+        const OpcodeShape *shape = &shapes[opcode];
+        int length = operandLength(kind);
+
+        uint8_t flags = entries->flags[offset];
+        if ((flags & AT_TARGET) && entries->depth[offset] != -1)
+        {
+            bool *snapshot = entries->numeric + entries->snapshot[offset];
+            if (!reachable)
+            {
+                reachable = true;
+                depth = entries->depth[offset];
+                for (int i = 0; i < depth; i++)
+                {
+                    numeric[i] = snapshot[i];
+                }
+            }
+            else if (depth != entries->depth[offset])
+            {
+                return invalid(vm, chunk, offset, "%d values on the stack here, %d along a jump.",
+                               depth, entries->depth[offset]);
+            }
+            else
+            {
+                for (int i = 0; i < depth; i++)
+                {
+                    numeric[i] = numeric[i] && snapshot[i];
+                }
+            }
+        }
+        // A loop after a return is dead code. Its header keeps no depth,
+        // so a back edge to it that is reachable after all is rejected.
+        if ((flags & AT_LOOP_HEADER) && reachable)
+        {
+            entries->depth[offset] = depth;
+            for (int i = 0; i < depth; i++)
+            {
+                numeric[i] = false;
+            }
+        }
+        if (!reachable)
+        {
+            offset = operand + length;
+            continue;
+        }
+
+        int pops = shape->pops;
+        if (shape->operand == OPERAND_COUNT || shape->operand == OPERAND_ARGS)
+        {
+            pops += chunk->code[operand];
+        }
+        if (opcode == OP_TAIL_CALL && base == 0)
+        {
+            return invalid(vm, chunk, offset, "OP_TAIL_CALL outside a function.");
+        }
+        if (depth < pops)
+        {
+            return invalid(vm, chunk, offset, "%s pops %d, the stack holds %d.",
+                           opcodeName(opcode), pops, depth);
+        }
+        int slot = -1;
+        if (shape->operand == OPERAND_SLOT || shape->operand == OPERAND_SLOT_LONG)
+        {
+            slot = readOperand(chunk, operand, length);
+            // Only slots below the operands are locals.
+            if (slot >= depth - pops)
+            {
+                return invalid(vm, chunk, offset, "local slot %d out of range, %d are live.",
+                               slot, depth - pops);
+            }
+        }
+        // A checked add succeeds on a number only by adding numbers, so one
+        // numeric operand is enough to prove its result.
+        bool allNumeric = true;
+        bool anyNumeric = false;
+        if (shape->needsNumbers || shape->result == RESULT_OPERANDS)
+        {
+            for (int i = depth - pops; i < depth; i++)
+            {
+                allNumeric = allNumeric && numeric[i];
+                anyNumeric = anyNumeric || numeric[i];
+            }
+        }
+        if (shape->needsNumbers && !allNumeric)
+        {
+            return invalid(vm, chunk, offset, "%s needs operands proven to be numbers.",
+                           opcodeName(opcode));
+        }
+        depth += shape->pushes - pops;
+        if (depth > maxDepth)
+        {
+            maxDepth = depth;
+        }
+        if (maxDepth > STACK_MAX)
+        {
+            return invalid(vm, chunk, offset, "needs more than %d stack slots.", STACK_MAX);
+        }
+        if (shape->pushes > 0)
+        {
+            switch (shape->result)
+            {
+            case RESULT_ANY:
+                numeric[depth - 1] = false;
+                break;
+            case RESULT_NUMBER:
+                numeric[depth - 1] = true;
+                break;
+            case RESULT_OPERANDS:
+                numeric[depth - 1] = anyNumeric;
+                break;
+            case RESULT_CONSTANT:
+            {
+                int index = readOperand(chunk, operand, length);
+                numeric[depth - 1] = IS_NUMERIC(chunk->constants.values[index]);
+                break;
+            }
+            case RESULT_SLOT:
+                numeric[depth - 1] = numeric[slot];
+                break;
+            }
+        }
+        if (opcode == OP_SET_LOCAL || opcode == OP_SET_LOCAL_LONG)
+        {
+            numeric[slot] = numeric[depth - 1];
+        }
+
+        if (shape->operand == OPERAND_JUMP || shape->operand == OPERAND_LOOP)
+        {
+            int target = jumpTarget(chunk, offset, shape->operand);
+            if (!(entries->flags[target] & AT_INSTRUCTION))
+            {
+                return invalid(vm, chunk, offset, "jump into the middle of an instruction at %d.",
+                               target);
+            }
+            if (shape->operand == OPERAND_JUMP)
+            {
+                if (!recordJump(vm, chunk, entries, offset, target, depth, numeric))
+                {
+                    return false;
+                }
+            }
+            else if (entries->depth[target] == -1)
+            {
+                return invalid(vm, chunk, offset, "loop to %d, an unreachable header.", target);
+            }
+            else if (entries->depth[target] != depth)
+            {
+                return invalid(vm, chunk, offset, "loop with %d values, %d at its header.",
+                               depth, entries->depth[target]);
+            }
+        }
+        reachable = opcode != OP_JUMP && opcode != OP_LOOP && opcode != OP_RETURN;
+        offset = operand + length;
+    }
+    if (reachable)
+    {
+        return invalid(vm, chunk, offset, "code runs past the end without OP_RETURN.");
+    }
+    chunk->maxStack = maxDepth;
+    return true;
+}
+
+// base is how many slots the frame starts with: none for the script,
+// the callee and its arguments for a function. Functions in the constant
+// pool are verified along with the chunk that declares them.
+static bool verifyCode(VM *vm, Chunk *chunk, int base)
+{
+    chunk->verified = false;
+    if (chunk->count == 0)
+    {
+        return invalid(vm, chunk, 0, "code runs past the end without OP_RETURN.");
+    }
+
+    Entries entries;
+    entries.flags = ALLOCATE(vm, uint8_t, chunk->count);
+    entries.depth = ALLOCATE(vm, int, chunk->count);
+    entries.snapshot = ALLOCATE(vm, int, chunk->count);
+    entries.numeric = NULL;
+    entries.numericCount = 0;
+    entries.numericCapacity = 0;
+    memset(entries.flags, 0, chunk->count);
+    for (int i = 0; i < chunk->count; i++)
+    {
+        entries.depth[i] = -1;
+    }
+
+    bool valid = findTargets(vm, chunk, &entries) && simulate(vm, chunk, &entries, base);
+    freeEntries(vm, chunk, &entries);
+    if (!valid)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        Value constant = chunk->constants.values[i];
+        if (!IS_FUNCTION(constant))
+        {
+            continue;
+        }
+        ObjFunction *function = AS_FUNCTION(constant);
+        if (!function->chunk.verified && !verifyCode(vm, &function->chunk, function->arity + 1))
+        {
+            return false;
+        }
+    }
+    chunk->verified = true;
+    return true;
+}
+
+bool verifyChunk(VM *vm, Chunk *chunk)
+{
+#ifdef DEBUG_PRINT_CODE
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+    uint64_t started = statsNow();
+    bool valid = verifyCode(vm, chunk, 0);
+    vm->stats.verifyNs += statsNow() - started;
+    if (!valid)
+    {
+        return false;
+    }
+#ifdef DEBUG_PRINT_CODE
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("== verified %d bytes, max stack %d, in %.1f us ==\n", chunk->count, chunk->maxStack,
+           (double)(end.tv_sec - start.tv_sec) * 1e6 + (double)(end.tv_nsec - start.tv_nsec) / 1e3);
+#endif
+    return true;
+}
+
+#undef AT_INSTRUCTION
+#undef AT_TARGET
+#undef AT_LOOP_HEADER
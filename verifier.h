@@ -0,0 +1,16 @@
+#ifndef clox_verifier_h
+#define clox_verifier_h
+
+#include "chunk.h"
+
+// Checks that a chunk can run without bounds checks: every opcode is
+// known, operands are complete and index the constant pool with the
+// expected type, jumps land on instructions with the same stack depth
+// along every path, the stack never underflows below the frame and never
+// grows past STACK_MAX, and the unchecked numeric opcodes only see values
+// proven to be numbers. The functions the chunk declares are verified
+// with it. On success chunk->verified is set and chunk->maxStack holds
+// the deepest stack the chunk reaches, counted from its frame's base.
+bool verifyChunk(VM *vm, Chunk *chunk);
+
+#endif
@@ -1,35 +1,85 @@
 #ifndef clox_vm_h
 #define clox_vm_h
-#define STACK_MAX 256
+// Locals share the stack with temporaries, so it is sized well past the
+// 256 slots a one-byte operand reaches.
+#define STACK_MAX 4096
+#define FRAMES_MAX 256
 #include "chunk.h"
+#include "object.h"
+#include "output.h"
+#include "pool.h"
+#include "profiler.h"
+#include "sampler.h"
+#include "stats.h"
 #include "table.h"
 #include "value.h"
+
+// A caller suspended by a call. The running function's state lives in
+// the VM itself, where run() reaches it without indexing the frames.
 typedef struct
 {
+    ObjFunction *function;
+    Chunk *chunk;
+    uint8_t *ip;
+    Value *slots;
+} CallFrame;
+
+// Everything one isolate needs lives here: its stack, its tables and its
+// heap. Separate VMs share no mutable state and may run on separate
+// threads.
+struct sVM
+{
+    ObjFunction *function; // NULL while the script itself runs.
     Chunk *chunk;
     uint8_t *ip;
+    Value *slots;
+    CallFrame frames[FRAMES_MAX];
+    int frameCount;
+    uint64_t instructions;
+    // run() yields at the first backward jump or call once instructions
+    // reaches fuelLimit. UINT64_MAX, the default, never yields, which
+    // interpret() relies on since it frees the chunk when run() returns.
+    uint64_t fuelLimit;
     Value stack[STACK_MAX];
     Value *stackTop;
     Table globals;
     Table strings;
 
     Obj *objects;
+    Pool pool;
 
-} VM;
+    OutputBuffer buffer;
+    FILE *output;
+    FILE *errors;
+    VMStats stats;
+#ifdef PROFILE_ALLOCATIONS
+    AllocationProfiler allocations;
+#endif
+#ifdef PROFILE_OPCODES
+    OpcodeProfiler opcodes;
+#endif
+#ifdef PROFILE_SAMPLES
+    SampleProfiler samples;
+#endif
+};
 
 typedef enum
 {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_YIELD
 } InterpretResult;
 
-extern VM vm;
-
-void initVM();
-void freeVM();
-InterpretResult interpret(const char *source);
-void push(Value value);
-Value pop();
+void initVM(VM *vm);
+void freeVM(VM *vm);
+InterpretResult interpret(VM *vm, const char *source, size_t length);
+InterpretResult interpretStream(VM *vm, FILE *stream);
+InterpretResult interpretChunk(VM *vm, Chunk *chunk);
+InterpretResult resumeVM(VM *vm);
+void runtimeError(VM *vm, const char *format, ...);
+VMStats getStats(VM *vm);
+void push(VM *vm, Value value);
+Value pop(VM *vm);
 
 #endif
\ No newline at end of file